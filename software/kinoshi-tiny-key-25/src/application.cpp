@@ -7,11 +7,18 @@
 #include <Arduino.h>
 #include <algorithm>
 #include "application.h"
+#include "chain.h"
 #include "leds.h"
 #include "config.h"
+#include "controllers.hpp"
 #include "switch.hpp"
+#include "keymap.hpp"
 #include "midi_process.h"
 #include "pins.h"
+#include "scan_governor.h"
+#include "scheduler.hpp"
+#include "telemetry.h"
+#include <hardware/sync.h>
 
 extern "C" {
 #include "pico/bootrom.h"
@@ -19,30 +26,113 @@ extern "C" {
 
 namespace kinoshita_lab::kinoshi_tiny_key_25::application
 {
+void processKeyboard();
+
 namespace
 {
 
 switches::Switches switches_(pins::kPinPl, pins::kPinCp, pins::kPinSerialOut1, pins::kPinSerialOut2, pins::kPinSerialOut3, nullptr);
+keymap::Keymap keymap_;
+
+enum
+{
+    kKeyEventQueueSize = 128,  // power of 2. a state frame from a chained unit can change every key at once
+};
 
 struct Status
 {
-    bool timer_fired            = false;
-    int current_octave          = config::kDefaultOctave;
-    uint8_t noteon_velocity     = INT8_MAX;
-    int16_t pitch_bend_value    = 0;  // center
-    int pitch_bend_direction    = 0;  // -1, 0, 1
-    bool should_send_pitch_bend = false;
-    const float pitch_bend_step = (8192.f / (config::pitch_bend_time / 1000.f)) / (1000.f * 1000.f / config::kApplicationTimerIntervalUs);  // per timer tick
+    int current_octave         = config::kDefaultOctave;
+    int displayed_octave       = config::kMinOctave - 1;  // octave shown on the LED, updated by the LED task
+    int octave_before_tap      = config::kDefaultOctave;  // restored when an octave tap turns out to be a hold
+    int transpose              = 0;
+    uint8_t midi_channel       = config::kMidiChannel;
+    uint8_t modulation_control = config::kSelectableControlNumbers[0];
+    uint8_t noteon_velocity    = INT8_MAX;
+    uint32_t pitch_bend_tick   = 0;  // scheduler tick of the last pitch bend update
+    int num_switches_on        = 0;
+    uint32_t switch_window_us  = 0;  // local switch change being dispatched happened after this
+    uint8_t switch_scan_mode   = scan_governor::kNumModes;  // mode that detected it
+    uint32_t loop_last_us      = 0;
+    uint32_t loop_max_us       = 0;  // since the last telemetry snapshot
     struct KeyboardStatus
     {
-        bool shouldSend;
-        bool offOn;
         int8_t noteOnNoteNumber = -1;  // MIDI note number for "Note On" event
+        uint8_t noteOnChannel   = config::kMidiChannel;
+    };
+    KeyboardStatus keyboard_status[config::kChainMaxUnits][config::kNumKeyboardKeys];  // per chained unit
+
+    // key presses and releases of this unit and the chained units, in arrival order
+    struct KeyEvent
+    {
+        uint8_t unit;
+        uint8_t key_index;
+        bool off_on;
+        uint8_t scan_mode;  // press latency, kNumModes: not measured (chained units)
+        uint32_t pressed_after_us;
     };
-    KeyboardStatus keyboard_status[config::kNumKeyboardKeys];
+    KeyEvent key_events[kKeyEventQueueSize];
+    uint32_t key_events_head    = 0;
+    uint32_t key_events_tail    = 0;
+    uint32_t dropped_key_events = 0;
 };
 Status status_;
 
+constexpr float kPitchBendStep = (8192.f / (config::pitch_bend_time / 1000.f)) / (1000.f * 1000.f / config::kApplicationTimerIntervalUs);  // per timer tick
+controllers::Controllers controllers_(midi_process::sendControlChange, midi_process::sendPitchBend, kPitchBendStep);
+
+// tasks
+void scanTask();
+void pitchBendTask();
+void chainTask();
+void governorTask();
+void ledTask();
+void statisticsTask();
+void telemetrySnapshotTask();
+void telemetryFlushTask();
+
+enum TaskId
+{
+    kTaskScan,
+    kTaskPitchBend,
+    kTaskChain,
+    kTaskDispatch,
+    kTaskUsb,
+    kTaskGovernor,
+    kTaskLed,
+    kTaskStatistics,
+    kTaskTelemetrySnapshot,
+    kTaskTelemetryFlush,
+    kNumTasks,
+};
+
+constexpr uint32_t toTicks(const uint32_t us)
+{
+    return us / config::kApplicationTimerIntervalUs;
+}
+
+constexpr uint32_t kTicksPerSecond = toTicks(1000 * 1000);
+static_assert(config::kTelemetryRateHz > 0 && kTicksPerSecond % config::kTelemetryRateHz == 0,
+              "kTelemetryRateHz must divide the application timer rate evenly");
+constexpr uint32_t kTelemetrySnapshotTicks = config::kTelemetryEnabled ? kTicksPerSecond / config::kTelemetryRateHz : scheduler::kPeriodDisabled;
+constexpr uint32_t kTelemetryFlushTicks    = config::kTelemetryEnabled ? 1 : scheduler::kPeriodDisabled;
+
+// input to output first, housekeeping after
+constexpr scheduler::Task kTasks[kNumTasks] = {
+    {"scan", scanTask, toTicks(config::kIdleScanPeriodUs), 500, scheduler::kPriorityInput},  // period set by the scan governor
+    {"pitch bend", pitchBendTask, 1, 500, scheduler::kPriorityInput},
+    {"chain", chainTask, 0, 500, scheduler::kPriorityInput},
+    {"dispatch", processKeyboard, 0, 1000, scheduler::kPriorityInput},
+    {"usb", midi_process::loop, 0, 1000, scheduler::kPriorityInput},
+    {"governor", governorTask, toTicks(1000), 1000, scheduler::kPriorityHousekeeping},
+    {"led", ledTask, toTicks(20 * 1000), 20 * 1000, scheduler::kPriorityHousekeeping},
+    {"statistics", statisticsTask, toTicks(config::kTaskStatisticsIntervalMs * 1000), 100 * 1000, scheduler::kPriorityHousekeeping},
+    {"telemetry snapshot", telemetrySnapshotTask, kTelemetrySnapshotTicks, 1000, scheduler::kPriorityHousekeeping},
+    {"telemetry flush", telemetryFlushTask, kTelemetryFlushTicks, 1000, scheduler::kPriorityHousekeeping},
+};
+static_assert(scheduler::isSortedByPriority(kTasks), "tasks must be ordered by priority");
+
+scheduler::Scheduler<kNumTasks> scheduler_(kTasks, config::kApplicationTimerIntervalUs);
+
 void setOctaveWithDelta(const int delta)
 {
     const auto prev    = status_.current_octave;
@@ -51,13 +141,134 @@ void setOctaveWithDelta(const int delta)
         return;
     }
     Serial.printf("Octave changed: %d -> %d\n", prev, new_val);
-    leds::setOctaveLed(new_val);
     status_.current_octave = new_val;
 }
+
+void pushKeyEvent(const uint8_t unit, const uint8_t key_index, const int off_on,
+                  const uint8_t scan_mode = scan_governor::kNumModes, const uint32_t pressed_after_us = 0)
+{
+    if (status_.key_events_head - status_.key_events_tail >= kKeyEventQueueSize) {
+        status_.dropped_key_events++;
+        return;
+    }
+    status_.key_events[status_.key_events_head & (kKeyEventQueueSize - 1)] = {unit, key_index, off_on != 0, scan_mode, pressed_after_us};
+    status_.key_events_head++;
+}
+
+// action handlers, indexed by keymap::ActionType
+using ActionHandler = void (*)(const keymap::Action& action, const int off_on);
+
+void onNote(const keymap::Action& action, const int off_on)
+{
+    pushKeyEvent(config::kChainUnitId, action.value, off_on, status_.switch_scan_mode, status_.switch_window_us);
+}
+
+void onSustain(const keymap::Action&, const int off_on)
+{
+    controllers_.sustain(off_on, status_.midi_channel);
+}
+
+void onModulation(const keymap::Action&, const int off_on)
+{
+    controllers_.modulation(off_on, status_.modulation_control, status_.midi_channel);
+}
+
+void onPitchBend(const keymap::Action& action, const int off_on)
+{
+    controllers_.pitchBend(off_on ? action.value : 0, status_.midi_channel);
+}
+
+void onOctave(const keymap::Action& action, const int off_on)
+{
+    if (off_on == keymap::kActionCancelled) {
+        // restore rather than apply the opposite delta, which would be wrong if the tap was clamped
+        setOctaveWithDelta(status_.octave_before_tap - status_.current_octave);
+    } else if (off_on) {
+        status_.octave_before_tap = status_.current_octave;
+        setOctaveWithDelta(action.value);
+    }
+}
+
+void onChannel(const keymap::Action& action, const int off_on)
+{
+    if (off_on) {
+        Serial.printf("MIDI channel changed: %d -> %d\n", status_.midi_channel, action.value);
+        status_.midi_channel = action.value;
+    }
+}
+
+void onTranspose(const keymap::Action& action, const int off_on)
+{
+    if (off_on) {
+        Serial.printf("Transpose changed: %d -> %d\n", status_.transpose, action.value);
+        status_.transpose = action.value;
+    }
+}
+
+void onControlNumber(const keymap::Action& action, const int off_on)
+{
+    if (off_on) {
+        Serial.printf("Modulation CC changed: %d -> %d\n", status_.modulation_control, action.value);
+        status_.modulation_control = action.value;
+    }
+}
+
+constexpr ActionHandler kActionHandlers[keymap::kNumActionTypes] = {
+    nullptr,          // kActionNone
+    nullptr,          // kActionTransparent
+    onNote,           // kActionNote
+    onSustain,        // kActionSustain
+    onModulation,     // kActionModulation
+    onPitchBend,      // kActionPitchBend
+    onOctave,         // kActionOctave
+    onChannel,        // kActionChannel
+    onTranspose,      // kActionTranspose
+    onControlNumber,  // kActionControlNumber
+    nullptr,          // kActionLayer, handled in keymap
+    nullptr,          // kActionLayerTap, handled in keymap
+};
+
+void actionTriggered(const keymap::Action& action, const int off_on)
+{
+    const auto handler = kActionHandlers[action.type];
+    if (handler) {
+        handler(action, off_on);
+    }
+}
+
+// switch of a chained unit. keys play with the unit's note offset and channel,
+// the other switches act on the shared state through the base layer (Oct-/Oct+ only change octave).
+void remoteSwitchChanged(const uint8_t unit, const uint32_t switch_index, const int off_on)
+{
+    if (switch_index >= switches::Switches::kNumSwitches) {
+        return;
+    }
+    Serial.printf("Unit %d switch %d is %s\n", unit, static_cast<int>(switch_index), off_on ? "ON" : "OFF");
+    auto action = keymap::kKeymap[keymap::kLayerBase][switch_index];
+    if (action.type == keymap::kActionLayerTap) {
+        action = keymap::action(action.tap_type, action.tap_value);
+    }
+    if (action.type == keymap::kActionNote) {
+        pushKeyEvent(unit, action.value, off_on);
+        return;
+    }
+    actionTriggered(action, off_on);
+}
 }
 void initialize()
 {
     status_.current_octave = config::kDefaultOctave;
+    if (config::kCalibrateScanClockOnBoot) {
+        const auto c = switches_.calibrateClock();
+        if (c.failed()) {
+            Serial.printf("Scan clock calibration failed: errors at every step down from %d cycles, falling back to %d cycles without frame validation\n",
+                          static_cast<int>(switches::Switches::kMaxEdgeDelayCycles), static_cast<int>(c.operating_cycles));
+        } else {
+            Serial.printf("Scan clock calibrated: edge delay %d cycles (fastest error free %d, first failing %d)\n",
+                          static_cast<int>(c.operating_cycles), static_cast<int>(c.fastest_error_free_cycles),
+                          c.first_failing_cycles == switches::Switches::kCalibrationNoFailure ? -1 : static_cast<int>(c.first_failing_cycles));
+        }
+    }
     // initial switch read
     switches_.forceScan();
 
@@ -71,49 +282,59 @@ void initialize()
         return;
     }
 
+    for (auto i = 0u; i < switches::Switches::kNumSwitches; ++i) {
+        status_.num_switches_on += switches_.switchIsOn(i) ? 1 : 0;
+    }
+    scan_governor::initialize(micros());
+    keymap_.setHandler(actionTriggered);
     switches_.setHandler(switchStateChanged);
+    chain::initialize(remoteSwitchChanged, switches_.packedState());
     leds::initialize();
-    leds::setOctaveLed(status_.current_octave);
+    ledTask();
     midi_process::initialize();
+    status_.pitch_bend_tick = scheduler_.ticks();
+    scheduler_.start();
 }
 
 void timerFired()
 {
-    status_.timer_fired = true;  // rough timer flag
-    // process pitch bend(cannot process in idle loop because of timing)
-    // calc value, send on loop
-    if (status_.pitch_bend_direction != 0) {
-        const auto new_pitch_bend_value = std::clamp<int16_t>(status_.pitch_bend_value + status_.pitch_bend_direction * status_.pitch_bend_step, -8192, 8191);
-        if (new_pitch_bend_value == status_.pitch_bend_value) {
-            // reached max/min
-            return;
-        }
-        status_.pitch_bend_value       = new_pitch_bend_value;
-        status_.should_send_pitch_bend = true;
-    }
+    scheduler_.tick();
 }
 
 void processKeyboard()
 {
-    for (auto i = 0; i < config::kNumKeyboardKeys; ++i) {
-        if (status_.keyboard_status[i].shouldSend) {
-            status_.keyboard_status[i].shouldSend = false;
-            if (status_.keyboard_status[i].offOn) {
-                // on
-                constexpr int num_note_per_octave           = 12;
-                const auto on_note_number                   = (status_.current_octave + 1) * num_note_per_octave + i;
-                status_.keyboard_status[i].noteOnNoteNumber = on_note_number;
-                midi_process::sendNoteOn(on_note_number, status_.noteon_velocity, config::kMidiChannel);
-                Serial.printf("Note On sent: note=%d, velocity=%d, channel=%d\n",
-                              on_note_number, status_.noteon_velocity, config::kMidiChannel);
-            } else {  // off
-                const auto off_note_number = status_.keyboard_status[i].noteOnNoteNumber;
-                if (off_note_number >= 0) {
-                    midi_process::sendNoteOff(off_note_number, 0, config::kMidiChannel);
-                    Serial.printf("Note Off sent: note=%d, velocity=0, channel=%d\n",
-                                  off_note_number, config::kMidiChannel);
-                    status_.keyboard_status[i].noteOnNoteNumber = -1;
-                }
+    while (status_.key_events_tail != status_.key_events_head) {
+        const auto event = status_.key_events[status_.key_events_tail & (kKeyEventQueueSize - 1)];
+        status_.key_events_tail++;
+
+        const auto& unit = config::kChainUnits[event.unit];
+        auto& key_status = status_.keyboard_status[event.unit][event.key_index];
+        if (event.off_on) {
+            // on
+            constexpr int num_note_per_octave = 12;
+            const auto on_note_number         = (status_.current_octave + 1) * num_note_per_octave + event.key_index + status_.transpose + unit.note_offset;
+            const auto channel                = unit.channel ? unit.channel : status_.midi_channel;
+            if (on_note_number < 0 || on_note_number > 127) {
+                continue;
+            }
+            key_status.noteOnNoteNumber = on_note_number;
+            key_status.noteOnChannel    = channel;
+            midi_process::sendNoteOn(on_note_number, status_.noteon_velocity, channel);
+            if (event.scan_mode < scan_governor::kNumModes) {
+                // queued for the MIDI ports, which are flushed later in this same pass
+                scan_governor::recordPressLatency(static_cast<scan_governor::Mode>(event.scan_mode), micros() - event.pressed_after_us);
+            }
+            Serial.printf("Note On sent: note=%d, velocity=%d, channel=%d\n",
+                          on_note_number, status_.noteon_velocity, channel);
+        } else {  // off
+            // note off goes to the note/channel used for note on, even if octave, transpose or channel changed meanwhile
+            const auto off_note_number = key_status.noteOnNoteNumber;
+            const auto off_channel     = key_status.noteOnChannel;
+            if (off_note_number >= 0) {
+                midi_process::sendNoteOff(off_note_number, 0, off_channel);
+                Serial.printf("Note Off sent: note=%d, velocity=0, channel=%d\n",
+                              off_note_number, off_channel);
+                key_status.noteOnNoteNumber = -1;
             }
         }
     }
@@ -122,76 +343,128 @@ void processKeyboard()
 void switchStateChanged(uint32_t switch_index, const int off_on)
 {
     Serial.printf("Switch %d is %s\n", switch_index, off_on ? "ON" : "OFF");
-
-    switch (switch_index) {
-        case switches::Switches::kSwitchIdC1... switches::Switches::kSwitchIdF2: {  // keyboard keys
-            const auto key_index                          = switch_index - switches::Switches::kSwitchIdC1;
-            status_.keyboard_status[key_index].shouldSend = true;
-            status_.keyboard_status[key_index].offOn      = off_on;
-        }
-            return;
-        case switches::Switches::kSwitchIdSustain:
-            midi_process::sendSustain(off_on != 0, config::kMidiChannel);
-            return;
-        case switches::Switches::kSwitchIdModulation:
-            midi_process::sendMoulation(off_on != 0, config::kMidiChannel);
-            return;
-        case switches::Switches::kSwitchIdPitchBendPlus:
-            status_.pitch_bend_direction   = off_on ? 1 : 0;
-            status_.should_send_pitch_bend = true;  // send immediately
-            return;
-        case switches::Switches::kSwitchIdPitchBendMinus:
-            status_.pitch_bend_direction   = off_on ? -1 : 0;
-            status_.should_send_pitch_bend = true;  // send immediately
-            return;
-        default:
-            break;
-    }
-
-    // on trigger switches
-    if (off_on) {
-        switch (switch_index) {
-            case switches::Switches::kSwitchIdOctMinus:
-                setOctaveWithDelta(-1);
-                break;
-            case switches::Switches::kSwitchIdOctPlus:
-                setOctaveWithDelta(1);
-                break;
-            default:
-                break;
-        }
+    status_.num_switches_on += off_on ? 1 : -1;
+    status_.switch_window_us = switches_.changeWindowStartUs();
+    status_.switch_scan_mode = scan_governor::mode();  // before the activity switches it to active
+    scan_governor::notifyActivity(micros());
+    if (config::kChainRole == config::kChainRoleSecondary) {
+        // the primary plays it
+        chain::switchStateChanged(switch_index, off_on, micros());
         return;
     }
+    keymap_.switchStateChanged(switch_index, off_on, millis());
 }
-void processPitchBend();
 
 void loop()
 {
-    switches_.update();
-    processTimerTick();
-    processKeyboard();
-    processPitchBend();
-    midi_process::loop();
+    const auto start = micros();
+    scheduler_.run();
+    status_.loop_last_us = micros() - start;
+    status_.loop_max_us  = std::max(status_.loop_max_us, status_.loop_last_us);
+
+    // sleep until the next timer tick or USB interrupt.
+    // interrupts are masked while checking, so a tick between the check and __wfi still wakes us.
+    const auto irq = save_and_disable_interrupts();
+    if (!scheduler_.hasDueTask()) {
+        scan_governor::sleep();
+    }
+    restore_interrupts(irq);
 }
-void processPitchBend()
+
+namespace
+{
+void scanTask()
+{
+    switches_.scan();
+    keymap_.update(millis());
+}
+
+void pitchBendTask()
+{
+    const auto now          = scheduler_.ticks();
+    const auto elapsed      = now - status_.pitch_bend_tick;
+    status_.pitch_bend_tick = now;
+    controllers_.update(elapsed);
+}
+
+void chainTask()
 {
-    if (!status_.should_send_pitch_bend) {
+    chain::loop();
+}
+
+void governorTask()
+{
+    const auto period_us = scan_governor::update(micros(), status_.num_switches_on > 0);
+    scheduler_.setPeriodTicks(kTaskScan, toTicks(period_us));
+}
+
+void ledTask()
+{
+    if (status_.displayed_octave == status_.current_octave) {
         return;
     }
-    status_.should_send_pitch_bend = false;
+    status_.displayed_octave = status_.current_octave;
+    leds::setOctaveLed(status_.displayed_octave);
+}
 
-    if (status_.pitch_bend_direction == 0) {
-        status_.pitch_bend_value = 0;  // reset to center when stopped
+void statisticsTask()
+{
+    static uint32_t reported_overruns[kNumTasks] = {0};
+    for (auto i = 0u; i < kNumTasks; ++i) {
+        const auto& stat = scheduler_.statistics(i);
+        if (stat.overruns == reported_overruns[i]) {
+            continue;
+        }
+        reported_overruns[i] = stat.overruns;
+        Serial.printf("Task %s: runs %d, overruns %d, max exec %d us, max response %d us\n",
+                      kTasks[i].name, static_cast<int>(stat.runs), static_cast<int>(stat.overruns),
+                      static_cast<int>(stat.max_exec_us), static_cast<int>(stat.max_response_us));
     }
-
-    midi_process::sendPitchBend(status_.pitch_bend_value, config::kMidiChannel);
+    static uint32_t reported_dropped_key_events = 0;
+    if (status_.dropped_key_events != reported_dropped_key_events) {
+        reported_dropped_key_events = status_.dropped_key_events;
+        Serial.printf("Key events dropped: %d\n", static_cast<int>(reported_dropped_key_events));
+    }
+    static uint32_t reported_corrupted_scan_frames = 0;
+    if (switches_.corruptedFrames() != reported_corrupted_scan_frames) {
+        reported_corrupted_scan_frames = switches_.corruptedFrames();
+        Serial.printf("Scan frames corrupted: %d of %d (%s)\n", static_cast<int>(reported_corrupted_scan_frames),
+                      static_cast<int>(switches_.scannedFrames()), switches_.validatesFrames() ? "discarded" : "decoded anyway");
+    }
+    scan_governor::logStatistics();
+    chain::logStatistics();
 }
 
-void processTimerTick()
+void telemetrySnapshotTask()
 {
-    if (!status_.timer_fired) {
-        return;
+    auto overruns = 0u;
+    for (auto i = 0u; i < kNumTasks; ++i) {
+        overruns += scheduler_.statistics(i).overruns;
     }
-    status_.timer_fired = false;
+
+    auto& frame                 = telemetry::beginSnapshot();
+    frame.timestamp_us          = micros();
+    frame.switches              = switches_.packedState();
+    frame.octave                = status_.current_octave;
+    frame.transpose             = status_.transpose;
+    frame.midi_channel          = status_.midi_channel;
+    frame.scan_mode             = scan_governor::mode();
+    frame.pitch_bend            = controllers_.pitchBendValue();
+    frame.usb_midi_queue        = std::min<uint32_t>(midi_process::queueDepth(midi_process::kSinkUsb), UINT8_MAX);
+    frame.din_midi_queue        = std::min<uint32_t>(midi_process::queueDepth(midi_process::kSinkDin), UINT8_MAX);
+    frame.usb_midi_dropped      = midi_process::droppedMessages(midi_process::kSinkUsb);
+    frame.din_midi_dropped      = midi_process::droppedMessages(midi_process::kSinkDin);
+    frame.corrupted_scan_frames = switches_.corruptedFrames();
+    frame.task_overruns         = overruns;
+    frame.loop_last_us          = std::min<uint32_t>(status_.loop_last_us, UINT16_MAX);
+    frame.loop_max_us           = std::min<uint32_t>(status_.loop_max_us, UINT16_MAX);
+    telemetry::commitSnapshot();
+    status_.loop_max_us = 0;
+}
+
+void telemetryFlushTask()
+{
+    telemetry::flush();
+}
 }
 }  // namespace kinoshita_lab::tiny_kino_key_25::application
\ No newline at end of file
@@ -15,7 +15,6 @@ namespace kinoshita_lab::kinoshi_tiny_key_25::application
 void initialize();
 void timerFired();
 void loop();
-void processTimerTick();
 
 void switchStateChanged(uint32_t switch_index, const int off_on);
 } // namespace kinoshita_lab::tiny_kino_key_25::application
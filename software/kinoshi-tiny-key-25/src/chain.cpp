@@ -0,0 +1,153 @@
+/**
+ * @file	chain.cpp
+ * @brief	Multi unit chaining for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <Arduino.h>
+#include "chain.h"
+#include "chain_frame.hpp"
+#include "chain_link.hpp"
+#include "config.h"
+#include "pins.h"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::chain
+{
+namespace
+{
+using chain_frame::Frame;
+
+chain_frame::Parser parser_;
+uint32_t rejected_frames_ = 0;  // valid on the wire but not for us: unknown unit, too many hops
+
+chain_link::Merger<config::kChainMaxUnits> merger_;  // primary: what every unit has sent so far
+chain_link::DeltaEncoder encoder_;                    // secondary: changes of the current scan
+
+constexpr uint32_t wireTimeUs(const size_t bytes)
+{
+    return static_cast<uint32_t>(bytes * 10 * 1000000ull / config::kChainBaudRate);  // 8N1
+}
+
+void send(const Frame& frame)
+{
+    uint8_t bytes[chain_frame::kMaxFrameSize];
+    const auto size = chain_frame::encode(frame, bytes);
+    Serial2.write(bytes, size);
+}
+
+// primary: merge into the local event stream in arrival order
+void merge(const Frame& frame, const uint32_t age_us)
+{
+    const auto result = merger_.merge(frame, age_us, millis());
+    if (result.came_online) {
+        Serial.printf("Chain unit %d online, %d hops\n", frame.unit, frame.hops);
+    } else if (result.lost_frames) {
+        Serial.printf("Chain unit %d: %d frames lost\n", frame.unit, result.lost_frames);
+    }
+}
+
+// a frame from the unit below us is complete
+// its age grows by the time on the wire and, on a secondary, by the time until it is sent on.
+// the time the bytes wait in the UART fifo before loop() reads them is not seen.
+void received(Frame frame, const uint32_t received_at_us)
+{
+    frame.hops++;
+    const auto age_us = frame.age_us + wireTimeUs(frame.size());
+    if (frame.unit >= config::kChainMaxUnits || frame.unit == config::kChainUnitId || frame.hops > chain_frame::kMaxHops) {
+        rejected_frames_++;
+        return;
+    }
+    if (config::kChainRole == config::kChainRolePrimary) {
+        merge(frame, age_us);
+        return;
+    }
+    frame.age_us = chain_link::saturate(age_us + (micros() - received_at_us));
+    send(frame);
+}
+
+void checkTimeouts()
+{
+    const auto timed_out = merger_.checkTimeouts(millis());
+    for (auto unit = 0u; unit < config::kChainMaxUnits; ++unit) {
+        if (timed_out & (1u << unit)) {
+            Serial.printf("Chain unit %d timed out\n", static_cast<int>(unit));
+        }
+    }
+}
+}
+
+void initialize(RemoteSwitchHandler handler, uint32_t local_state)
+{
+    merger_  = decltype(merger_)(handler);
+    encoder_ = chain_link::DeltaEncoder(config::kChainUnitId, local_state);
+    if (config::kChainRole == config::kChainRoleStandalone) {
+        return;
+    }
+    // frames from further down the chain. the end of the chain just never receives anything.
+    Serial1.setRX(pins::kPinChainRx);
+    Serial1.setFIFOSize(256);  // a few frames, in case a housekeeping task holds the loop
+    Serial1.begin(config::kChainBaudRate);
+    if (config::kChainRole == config::kChainRoleSecondary) {
+        Serial2.begin(config::kChainBaudRate);
+    }
+}
+
+void switchStateChanged(uint32_t switch_index, int off_on, uint32_t now_us)
+{
+    if (config::kChainRole != config::kChainRoleSecondary) {
+        return;
+    }
+    encoder_.switchStateChanged(switch_index, off_on, now_us);
+}
+
+void loop()
+{
+    if (config::kChainRole == config::kChainRoleStandalone) {
+        return;
+    }
+    while (Serial1.available() > 0) {
+        parser_.feed(static_cast<uint8_t>(Serial1.read()), [](const Frame& frame) { received(frame, micros()); });
+    }
+    if (config::kChainRole == config::kChainRolePrimary) {
+        checkTimeouts();
+    } else {
+        encoder_.update(micros(), millis(), send);
+    }
+}
+
+const UnitStatistics& unitStatistics(uint8_t unit)
+{
+    return merger_.statistics(unit);
+}
+
+uint32_t corruptedFrames()
+{
+    return parser_.corruptedFrames() + rejected_frames_;
+}
+
+void logStatistics()
+{
+    if (config::kChainRole != config::kChainRolePrimary) {
+        return;
+    }
+    static uint32_t reported_frames[config::kChainMaxUnits] = {0};
+    static uint32_t reported_corrupted_frames               = 0;
+    for (auto unit = 1u; unit < config::kChainMaxUnits; ++unit) {
+        const auto& stat = merger_.statistics(unit);
+        if (stat.frames == reported_frames[unit]) {
+            continue;
+        }
+        reported_frames[unit] = stat.frames;
+        const auto average_us = stat.delta_frames ? stat.total_age_us / stat.delta_frames : 0;
+        Serial.printf("Chain unit %d: %s, %d hops, %d frames, %d lost, latency avg %d us max %d us, %d us per hop\n",
+                      static_cast<int>(unit), stat.online ? "online" : "offline", stat.hops,
+                      static_cast<int>(stat.frames), static_cast<int>(stat.lost_frames),
+                      static_cast<int>(average_us), static_cast<int>(stat.max_age_us),
+                      static_cast<int>(stat.hops ? average_us / stat.hops : 0));
+    }
+    if (corruptedFrames() != reported_corrupted_frames) {
+        reported_corrupted_frames = corruptedFrames();
+        Serial.printf("Chain: %d corrupted frames\n", static_cast<int>(reported_corrupted_frames));
+    }
+}
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::chain
@@ -0,0 +1,36 @@
+/**
+ * @file	chain.h
+ * @brief	Multi unit chaining for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <cstdint>
+#include "chain_link.hpp"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::chain
+{
+// primary: switch change of a secondary unit, in arrival order
+using RemoteSwitchHandler = void (*)(uint8_t unit, uint32_t switch_index, int off_on);
+
+using UnitStatistics = chain_link::UnitStatistics;
+
+// local_state: packed switch state at boot, bit n is switch n
+void initialize(RemoteSwitchHandler handler, uint32_t local_state);
+
+// secondary: local switch change, sent with the next loop()
+void switchStateChanged(uint32_t switch_index, int off_on, uint32_t now_us);
+
+// call on every scheduler pass. forwards frames from further down, merges them on the primary,
+// sends the local changes and the periodic state on secondaries.
+void loop();
+
+const UnitStatistics& unitStatistics(uint8_t unit);
+uint32_t corruptedFrames();
+void logStatistics();
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::chain
+
+#endif  // CHAIN_H
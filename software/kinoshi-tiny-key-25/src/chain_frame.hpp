@@ -0,0 +1,200 @@
+/**
+ * @file	chain_frame.hpp
+ * @brief	Switch frames between chained Tiny KinoKey 25 units
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef CHAIN_FRAME_HPP
+#define CHAIN_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::chain_frame
+{
+// wire format, all multi byte fields little endian
+//  0 magic
+//  1 origin unit (high nibble) | hops (low nibble)
+//  2 type
+//  3 sequence, per origin unit
+//  4 age_us, 2 bytes: time since the origin saw the change, every hop adds its share
+//  6 payload length
+//  7 payload
+//  n checksum, all bytes sum to 0
+enum
+{
+    kMagic         = 0xc5,
+    kHeaderSize    = 7,
+    kMaxPayload    = 32,
+    kMaxFrameSize  = kHeaderSize + kMaxPayload + 1,
+    kMaxUnits      = 16,
+    kMaxHops       = 15,
+    kStatePayload  = 4,
+    kChangeOnBit   = 0x80,
+    kChangeIdMask  = 0x7f,
+};
+
+enum FrameType : uint8_t
+{
+    kFrameDelta,  // payload: one byte per changed switch, kChangeOnBit | switch index
+    kFrameState,  // payload: packed switch state, bit n is switch n. sent periodically, repairs lost deltas
+    kNumFrameTypes,
+};
+
+struct Frame
+{
+    uint8_t unit      = 0;
+    uint8_t hops      = 0;
+    FrameType type    = kFrameDelta;
+    uint8_t sequence  = 0;
+    uint16_t age_us   = 0;
+    uint8_t length    = 0;
+    uint8_t payload[kMaxPayload]{};
+
+    static constexpr uint8_t change(const uint32_t switch_index, const int off_on)
+    {
+        return static_cast<uint8_t>((off_on ? kChangeOnBit : 0) | (switch_index & kChangeIdMask));
+    }
+
+    void setState(const uint32_t state)
+    {
+        type   = kFrameState;
+        length = kStatePayload;
+        for (auto i = 0; i < kStatePayload; ++i) {
+            payload[i] = static_cast<uint8_t>(state >> (8 * i));
+        }
+    }
+
+    uint32_t state() const
+    {
+        auto state = 0u;
+        for (auto i = 0; i < kStatePayload; ++i) {
+            state |= static_cast<uint32_t>(payload[i]) << (8 * i);
+        }
+        return state;
+    }
+
+    // bytes on the wire
+    size_t size() const
+    {
+        return kHeaderSize + length + 1;
+    }
+};
+
+// returns the number of bytes written to out
+inline size_t encode(const Frame& frame, uint8_t (&out)[kMaxFrameSize])
+{
+    const auto length = frame.length < kMaxPayload ? frame.length : static_cast<uint8_t>(kMaxPayload);
+    out[0]            = kMagic;
+    out[1]            = static_cast<uint8_t>((frame.unit << 4) | (frame.hops & 0x0f));
+    out[2]            = frame.type;
+    out[3]            = frame.sequence;
+    out[4]            = static_cast<uint8_t>(frame.age_us);
+    out[5]            = static_cast<uint8_t>(frame.age_us >> 8);
+    out[6]            = length;
+
+    auto sum = 0u;
+    for (auto i = 0; i < kHeaderSize; ++i) {
+        sum += out[i];
+    }
+    for (auto i = 0u; i < length; ++i) {
+        out[kHeaderSize + i] = frame.payload[i];
+        sum += frame.payload[i];
+    }
+    out[kHeaderSize + length] = static_cast<uint8_t>(-sum);
+    return kHeaderSize + length + 1;
+}
+
+// byte at a time decoder. a frame that fails the checks is dropped and the parser hunts for the next magic,
+// starting right after the rejected one: the false start may have swallowed the beginning of a real frame,
+// or several whole frames, so one byte can complete more than one.
+class Parser
+{
+public:
+    // on_frame(const Frame&) is called for every frame the byte completes, in order. returns how many.
+    template <typename OnFrame>
+    size_t feed(const uint8_t byte, OnFrame&& on_frame)
+    {
+        if (push(byte)) {
+            on_frame(frame_);
+            return 1;
+        }
+        if (!rejected_) {
+            return 0;
+        }
+        rejected_ = false;
+        corrupted_frames_++;
+
+        uint8_t replay[kMaxFrameSize];
+        const auto num_bytes = received_ - 1;
+        for (auto i = 0u; i < num_bytes; ++i) {
+            replay[i] = buffer_[i + 1];
+        }
+        restart();
+        auto num_frames = size_t{0};
+        for (auto i = 0u; i < num_bytes; ++i) {
+            num_frames += feed(replay[i], on_frame);
+        }
+        return num_frames;
+    }
+
+    uint32_t corruptedFrames() const
+    {
+        return corrupted_frames_;
+    }
+
+protected:
+    bool push(const uint8_t byte)
+    {
+        if (received_ == 0 && byte != kMagic) {
+            return false;
+        }
+        buffer_[received_++] = byte;
+        sum_ += byte;
+
+        if (received_ == kHeaderSize && (buffer_[2] >= kNumFrameTypes || buffer_[6] > kMaxPayload)) {
+            return reject();
+        }
+        if (received_ < kHeaderSize || received_ < kHeaderSize + buffer_[6] + 1u) {
+            return false;
+        }
+        if (static_cast<uint8_t>(sum_) != 0) {
+            return reject();
+        }
+
+        frame_.unit     = buffer_[1] >> 4;
+        frame_.hops     = buffer_[1] & 0x0f;
+        frame_.type     = static_cast<FrameType>(buffer_[2]);
+        frame_.sequence = buffer_[3];
+        frame_.age_us   = static_cast<uint16_t>(buffer_[4] | (buffer_[5] << 8));
+        frame_.length   = buffer_[6];
+        for (auto i = 0u; i < frame_.length; ++i) {
+            frame_.payload[i] = buffer_[kHeaderSize + i];
+        }
+        restart();
+        return true;
+    }
+
+    bool reject()
+    {
+        rejected_ = true;
+        return false;
+    }
+
+    void restart()
+    {
+        received_ = 0;
+        sum_      = 0;
+    }
+
+    uint8_t buffer_[kMaxFrameSize]{};
+    size_t received_           = 0;
+    uint32_t sum_              = 0;
+    bool rejected_             = false;
+    uint32_t corrupted_frames_ = 0;
+    Frame frame_;  // only valid during on_frame
+};
+} // namespace kinoshita_lab::kinoshi_tiny_key_25::chain_frame
+
+#endif // CHAIN_FRAME_HPP
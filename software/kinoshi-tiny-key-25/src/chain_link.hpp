@@ -0,0 +1,212 @@
+/**
+ * @file	chain_link.hpp
+ * @brief	Secondary side delta encoding and primary side merge for chained Tiny KinoKey 25 units
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef CHAIN_LINK_HPP
+#define CHAIN_LINK_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "chain_frame.hpp"
+#include "config.h"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::chain_link
+{
+using chain_frame::Frame;
+
+struct UnitStatistics
+{
+    bool online           = false;
+    uint32_t state        = 0;  // packed switch state as seen by the primary
+    uint32_t frames       = 0;
+    uint32_t lost_frames  = 0;  // sequence gaps
+    uint8_t hops          = 0;  // links between the unit and the primary
+    uint32_t last_age_us  = 0;  // switch change on the unit to merge on the primary
+    uint32_t max_age_us   = 0;
+    uint32_t total_age_us = 0;  // over delta frames, for the average
+    uint32_t delta_frames = 0;
+};
+
+constexpr uint16_t saturate(const uint32_t us)
+{
+    return static_cast<uint16_t>(std::min<uint32_t>(us, UINT16_MAX));
+}
+
+// secondary: the changes of one scan go out as one delta frame, the packed state follows periodically
+class DeltaEncoder
+{
+public:
+    // local_state: packed switch state at boot, bit n is switch n
+    explicit DeltaEncoder(const uint8_t unit = 0, const uint32_t local_state = 0)
+        : unit_(unit), local_state_(local_state)
+    {
+    }
+
+    void switchStateChanged(const uint32_t switch_index, const int off_on, const uint32_t now_us)
+    {
+        local_state_ = off_on ? (local_state_ | (1u << switch_index)) : (local_state_ & ~(1u << switch_index));
+        if (pending_.length >= chain_frame::kMaxPayload) {
+            pending_overflow_ = true;  // too many changes for one frame, the state frame covers them
+            return;
+        }
+        if (pending_.length == 0) {
+            pending_since_us_ = now_us;
+        }
+        pending_.payload[pending_.length++] = Frame::change(switch_index, off_on);
+    }
+
+    // send(const Frame&) gets the pending delta frame, then the state frame when it is due
+    template <typename Send>
+    void update(const uint32_t now_us, const uint32_t now_ms, Send&& send)
+    {
+        if (pending_.length) {
+            pending_.type   = chain_frame::kFrameDelta;
+            pending_.age_us = saturate(now_us - pending_since_us_);
+            sendLocal(pending_, send);
+            pending_.length = 0;
+        }
+        if (pending_overflow_ || now_ms - last_state_ms_ >= config::kChainStateIntervalMs) {
+            pending_overflow_ = false;
+            last_state_ms_    = now_ms;
+            Frame state;
+            state.setState(local_state_);
+            sendLocal(state, send);
+        }
+    }
+
+    uint32_t localState() const
+    {
+        return local_state_;
+    }
+
+protected:
+    template <typename Send>
+    void sendLocal(Frame& frame, Send& send)
+    {
+        frame.unit     = unit_;
+        frame.hops     = 0;
+        frame.sequence = sequence_++;
+        send(static_cast<const Frame&>(frame));
+    }
+
+    uint8_t unit_;
+    uint32_t local_state_;
+    Frame pending_;
+    uint32_t pending_since_us_ = 0;
+    bool pending_overflow_     = false;
+    uint8_t sequence_          = 0;
+    uint32_t last_state_ms_    = 0;
+};
+
+// primary: merges the switch changes of every unit into the local event stream, in arrival order
+template <size_t kNumUnits>
+class Merger
+{
+    static_assert(kNumUnits <= chain_frame::kMaxUnits, "unit id is 4 bits");
+
+public:
+    using SwitchHandler = std::function<void(uint8_t unit, uint32_t switch_index, int off_on)>;
+
+    struct MergeResult
+    {
+        bool came_online    = false;
+        uint8_t lost_frames = 0;  // sequence gap before this frame
+    };
+
+    explicit Merger(SwitchHandler handler = nullptr)
+        : handler_(handler)
+    {
+    }
+
+    // age_us: switch change on the unit until now, for delta frames
+    MergeResult merge(const Frame& frame, const uint32_t age_us, const uint32_t now_ms)
+    {
+        MergeResult result;
+        if (frame.unit >= kNumUnits) {
+            return result;
+        }
+        auto& stat = units_[frame.unit];
+        if (!stat.online) {
+            stat.online        = true;
+            result.came_online = true;
+        } else if (frame.sequence != expected_sequence_[frame.unit]) {
+            result.lost_frames = static_cast<uint8_t>(frame.sequence - expected_sequence_[frame.unit]);
+            stat.lost_frames += result.lost_frames;
+        }
+        expected_sequence_[frame.unit] = frame.sequence + 1;
+        last_frame_ms_[frame.unit]     = now_ms;
+        stat.frames++;
+        stat.hops = frame.hops;
+
+        if (frame.type == chain_frame::kFrameState) {
+            const auto state = frame.state();
+            for (auto i = 0u; i < 32; ++i) {
+                apply(frame.unit, i, (state >> i) & 1);
+            }
+            return result;
+        }
+
+        for (auto i = 0u; i < frame.length; ++i) {
+            const auto change = frame.payload[i];
+            if ((change & chain_frame::kChangeIdMask) < 32) {
+                apply(frame.unit, change & chain_frame::kChangeIdMask, (change & chain_frame::kChangeOnBit) != 0);
+            }
+        }
+        stat.last_age_us = age_us;
+        stat.max_age_us  = std::max(stat.max_age_us, age_us);
+        stat.total_age_us += age_us;
+        stat.delta_frames++;
+        return result;
+    }
+
+    // releases every switch of a unit that has been silent for too long (unplugged: no stuck notes).
+    // returns the units that timed out, bit n is unit n.
+    uint32_t checkTimeouts(const uint32_t now_ms)
+    {
+        auto timed_out = 0u;
+        for (auto unit = 0u; unit < kNumUnits; ++unit) {
+            auto& stat = units_[unit];
+            if (!stat.online || now_ms - last_frame_ms_[unit] < config::kChainTimeoutMs) {
+                continue;
+            }
+            stat.online = false;
+            timed_out |= (1u << unit);
+            for (auto i = 0u; i < 32; ++i) {
+                apply(static_cast<uint8_t>(unit), i, 0);
+            }
+        }
+        return timed_out;
+    }
+
+    const UnitStatistics& statistics(const uint8_t unit) const
+    {
+        return units_[unit < kNumUnits ? unit : 0];
+    }
+
+protected:
+    void apply(const uint8_t unit, const uint32_t switch_index, const int off_on)
+    {
+        auto& stat     = units_[unit];
+        const auto bit = (1u << switch_index);
+        if (((stat.state & bit) != 0) == (off_on != 0)) {
+            return;  // already known, e.g. a delta that the state frame has repaired
+        }
+        stat.state ^= bit;
+        if (handler_) {
+            handler_(unit, switch_index, off_on);
+        }
+    }
+
+    SwitchHandler handler_;
+    UnitStatistics units_[kNumUnits];
+    uint8_t expected_sequence_[kNumUnits] = {0};
+    uint32_t last_frame_ms_[kNumUnits]    = {0};
+};
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::chain_link
+
+#endif  // CHAIN_LINK_HPP
@@ -8,6 +8,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <cstddef>
 #include <cstdint>
 #include "leds.h"
 namespace kinoshita_lab::kinoshi_tiny_key_25::config
@@ -24,6 +25,46 @@ enum
     kMidiChannel = 1,  // TODO: make it configurable via NRPN
 };
 
+// chain configuration
+// several units side by side as one instrument. a secondary sends its switch changes from UART1 TX
+// to the chain input of the next unit up, the primary plays every unit on its own USB and DIN ports.
+enum ChainRole
+{
+    kChainRoleStandalone,
+    kChainRolePrimary,
+    kChainRoleSecondary,
+};
+constexpr ChainRole kChainRole           = kChainRoleStandalone;
+constexpr uint8_t kChainUnitId           = 0;        // primary 0, secondaries 1.. unique in the chain
+constexpr uint32_t kChainBaudRate        = 1000000;  // unit to unit link: a frame with one change takes 90 us per hop
+constexpr uint32_t kChainStateIntervalMs = 100;      // full switch state from secondaries, repairs lost frames
+constexpr uint32_t kChainTimeoutMs       = 500;      // no frame from a unit this long: its switches are released
+enum
+{
+    kChainMaxUnits = 4,
+};
+struct ChainUnit
+{
+    int note_offset;  // semitones added to the notes of the unit
+    uint8_t channel;  // MIDI channel, 0: follow the primary
+};
+constexpr ChainUnit kChainUnits[kChainMaxUnits] = {
+    {0, 0},    // 0 primary
+    {24, 0},   // 1 right of the primary
+    {48, 0},   // 2
+    {-24, 0},  // 3 left of the primary
+};
+static_assert(kChainUnitId < kChainMaxUnits, "unit id out of range");
+
+// MIDI output configuration
+constexpr size_t kMidiPoolSize          = 64;  // encoded messages shared by all sinks, power of 2
+constexpr uint32_t kDinMidiBaudRate     = 31250;
+constexpr uint32_t kMidiSinkStallUs     = 20 * 1000;  // a sink refusing everything this long is skipped, not waited for
+constexpr bool kUsbMidiEnabled          = kChainRole != kChainRoleSecondary;  // a secondary's UART carries the chain
+constexpr bool kDinMidiEnabled          = kChainRole != kChainRoleSecondary;
+constexpr uint16_t kUsbMidiChannelMask  = 0xffff;  // bit n: channel n + 1
+constexpr uint16_t kDinMidiChannelMask  = 0xffff;
+
 // Pitch Bend configuration
 constexpr int pitch_bend_time = 250; // ms to reach from center to max/min TODO: make it configurable via NRPN
 
@@ -42,8 +83,44 @@ enum
     kNumKeys = 25,
 };
 
+// Keymap configuration
+constexpr uint32_t kTapHoldTermMs = 200;  // Oct-/Oct+ held longer than this, or held over a whole key press, select a function layer instead of changing octave
+constexpr int kTransposeCenterKey = 12;   // key index for transpose 0 on the transpose layer
+constexpr uint8_t kSelectableControlNumbers[] = {
+    1,   // modulation
+    2,   // breath
+    4,   // foot
+    7,   // volume
+    10,  // pan
+    11,  // expression
+    12,  // effect 1
+    13,  // effect 2
+    71,  // resonance
+    74,  // cutoff
+    91,  // reverb send
+    93,  // chorus send
+};
+
+// switch scan configuration
+constexpr bool kCalibrateScanClockOnBoot = true;  // find the fastest shift register clock without sentinel errors
+constexpr uint32_t kDebounceTimeUs       = 5000;  // a new switch level must be stable this long, whatever the scan period
+
+// scan governor configuration
+// worst case press detection latency is one scan period to see the change, then the first frame at least
+// kDebounceTimeUs later: 1 + 5 = 6 ms active, 10 + 10 = 20 ms idle.
+// the actual press to send latency is measured per mode and logged with the task statistics.
+constexpr uint32_t kActiveScanPeriodUs = 1000;    // 1 kHz while playing
+constexpr uint32_t kIdleScanPeriodUs   = 10000;   // 100 Hz when idle
+constexpr uint32_t kActiveHoldTimeUs   = 500000;  // stay active this long after the last switch change
+constexpr bool kSleepBetweenScans      = true;    // __wfi when there is nothing to do
+
+// telemetry configuration
+constexpr bool kTelemetryEnabled     = false;  // binary frames on USB CDC, see tools/telemetry_decode.py
+constexpr uint32_t kTelemetryRateHz  = 100;    // 36 byte frames: 3.6 kB/s at 100 Hz. must divide the 2 kHz timer rate
+
 // application timer configuration
 constexpr uint32_t kApplicationTimerIntervalUs = 500; // 500us
+constexpr uint32_t kTaskStatisticsIntervalMs   = 10 * 1000;  // task overruns are logged at most this often
 
 // color config for octave led
 constexpr leds::Color kOctaveColors[kNumOctaves] = {
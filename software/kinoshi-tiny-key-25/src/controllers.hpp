@@ -0,0 +1,123 @@
+/**
+ * @file	controllers.hpp
+ * @brief	Sustain, modulation and pitch bend switches for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef CONTROLLERS_HPP
+#define CONTROLLERS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include "config.h"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::controllers
+{
+enum
+{
+    kSustainControl = 64,
+};
+
+// the channel and CC number are taken when a switch is pressed. its release, and the bend back to
+// center, go to the same place even if the channel or the CC was changed while it was held,
+// like a note off goes to the note that was turned on.
+class Controllers
+{
+public:
+    using ControlChangeHandler = std::function<void(uint8_t control_number, uint8_t value, uint8_t channel)>;
+    using PitchBendHandler     = std::function<void(int16_t value, uint8_t channel)>;
+
+    // pitch_bend_step: bend per tick while a bend switch is held
+    explicit Controllers(ControlChangeHandler control_change = nullptr, PitchBendHandler pitch_bend = nullptr,
+                         const float pitch_bend_step = 0.f)
+        : control_change_(control_change), pitch_bend_(pitch_bend), pitch_bend_step_(pitch_bend_step)
+    {
+    }
+
+    void sustain(const int off_on, const uint8_t channel)
+    {
+        if (off_on) {
+            sustain_channel_ = channel;
+        }
+        controlChange(kSustainControl, off_on ? 127 : 0, sustain_channel_);
+    }
+
+    void modulation(const int off_on, const uint8_t control_number, const uint8_t channel)
+    {
+        if (off_on) {
+            modulation_control_ = control_number;
+            modulation_channel_ = channel;
+        }
+        controlChange(modulation_control_, off_on ? 127 : 0, modulation_channel_);
+    }
+
+    // direction -1, 1: bend while held, 0: back to center. sent with the next update()
+    void pitchBend(const int direction, const uint8_t channel)
+    {
+        if (direction && channel != pitch_bend_channel_) {
+            if (pitch_bend_value_ != 0) {
+                pitch_bend_value_ = 0;
+                sendPitchBend();  // the old channel must not stay bent
+            }
+            pitch_bend_channel_ = channel;
+        }
+        pitch_bend_direction_   = direction;
+        should_send_pitch_bend_ = true;  // send immediately
+    }
+
+    // advance by the ticks elapsed since the last call, so a late call doesn't slow the bend down
+    void update(const uint32_t elapsed_ticks)
+    {
+        if (pitch_bend_direction_ != 0) {
+            const auto new_value = std::clamp<int>(static_cast<int>(pitch_bend_value_ + pitch_bend_direction_ * pitch_bend_step_ * elapsed_ticks), -8192, 8191);
+            if (new_value != pitch_bend_value_) {
+                pitch_bend_value_       = new_value;
+                should_send_pitch_bend_ = true;
+            }
+        }
+        if (!should_send_pitch_bend_) {
+            return;
+        }
+        should_send_pitch_bend_ = false;
+        if (pitch_bend_direction_ == 0) {
+            pitch_bend_value_ = 0;  // reset to center when stopped
+        }
+        sendPitchBend();
+    }
+
+    int16_t pitchBendValue() const
+    {
+        return pitch_bend_value_;
+    }
+
+protected:
+    void controlChange(const uint8_t control_number, const uint8_t value, const uint8_t channel)
+    {
+        if (control_change_) {
+            control_change_(control_number, value, channel);
+        }
+    }
+
+    void sendPitchBend()
+    {
+        if (pitch_bend_) {
+            pitch_bend_(pitch_bend_value_, pitch_bend_channel_);
+        }
+    }
+
+    ControlChangeHandler control_change_;
+    PitchBendHandler pitch_bend_;
+    float pitch_bend_step_;
+    uint8_t sustain_channel_     = config::kMidiChannel;
+    uint8_t modulation_channel_  = config::kMidiChannel;
+    uint8_t modulation_control_  = config::kSelectableControlNumbers[0];
+    uint8_t pitch_bend_channel_  = config::kMidiChannel;
+    int16_t pitch_bend_value_    = 0;  // center
+    int pitch_bend_direction_    = 0;  // -1, 0, 1
+    bool should_send_pitch_bend_ = false;
+};
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::controllers
+
+#endif  // CONTROLLERS_HPP
@@ -0,0 +1,299 @@
+/**
+ * @file	keymap.hpp
+ * @brief	Keymap layers and tap/hold handling for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef KEYMAP_HPP
+#define KEYMAP_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include "config.h"
+#include "switch_ids.h"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::keymap
+{
+using switches::SwitchIds;
+
+enum Layer
+{
+    kLayerBase = 0,
+    kLayerChannel,     // hold Oct-: keys select MIDI channel
+    kLayerTranspose,   // hold Oct+: keys select transpose
+    kLayerControl,     // hold Oct- and Oct+ together: keys select CC number for the modulation switch
+    kNumLayers,
+};
+
+enum ActionType : uint8_t
+{
+    kActionNone = 0,
+    kActionTransparent,  // only used while building the tables, resolved to the base layer
+    kActionNote,         // value: key index from the bottom of the current octave
+    kActionSustain,
+    kActionModulation,
+    kActionPitchBend,      // value: direction (-1, 1)
+    kActionOctave,         // value: delta
+    kActionChannel,        // value: MIDI channel (1-16)
+    kActionTranspose,      // value: semitones
+    kActionControlNumber,  // value: CC number used by the modulation switch
+    kActionLayer,          // value: layer, active while held
+    kActionLayerTap,       // value: layer while held, tap_type/tap_value on tap
+    kNumActionTypes,
+};
+
+struct Action
+{
+    ActionType type     = kActionNone;
+    int8_t value        = 0;
+    ActionType tap_type = kActionNone;
+    int8_t tap_value    = 0;
+};
+
+// off_on of a tap action that was applied on press, taken back because the press turned out to be a hold
+constexpr int kActionCancelled = -1;
+
+// tap actions that can be taken back: applied on press, so a tap has no latency
+constexpr bool appliesOnPress(const ActionType type)
+{
+    return type == kActionOctave;
+}
+
+constexpr Action action(const ActionType type, const int value = 0)
+{
+    return Action{type, static_cast<int8_t>(value), kActionNone, 0};
+}
+
+constexpr Action layerTap(const int layer, const Action& tap)
+{
+    return Action{kActionLayerTap, static_cast<int8_t>(layer), tap.type, tap.value};
+}
+
+using KeymapTable = std::array<std::array<Action, SwitchIds::kNumSwitches>, kNumLayers>;
+
+// build flat [layer][switch] tables. transparent entries are resolved here so lookup never falls through.
+constexpr KeymapTable buildKeymap()
+{
+    KeymapTable table{};
+
+    // base layer
+    auto& base = table[kLayerBase];
+    for (auto i = 0; i < config::kNumKeyboardKeys; ++i) {
+        base[SwitchIds::kSwitchIdC1 + i] = action(kActionNote, i);
+    }
+    base[SwitchIds::kSwitchIdSustain]        = action(kActionSustain);
+    base[SwitchIds::kSwitchIdModulation]     = action(kActionModulation);
+    base[SwitchIds::kSwitchIdPitchBendPlus]  = action(kActionPitchBend, 1);
+    base[SwitchIds::kSwitchIdPitchBendMinus] = action(kActionPitchBend, -1);
+    base[SwitchIds::kSwitchIdOctMinus]       = layerTap(kLayerChannel, action(kActionOctave, -1));
+    base[SwitchIds::kSwitchIdOctPlus]        = layerTap(kLayerTranspose, action(kActionOctave, 1));
+
+    // function layers: keys are replaced, everything else falls through
+    for (auto layer = kLayerBase + 1; layer < kNumLayers; ++layer) {
+        for (auto i = 0u; i < SwitchIds::kNumSwitches; ++i) {
+            table[layer][i] = action(kActionTransparent);
+        }
+        for (auto i = 0; i < config::kNumKeyboardKeys; ++i) {
+            table[layer][SwitchIds::kSwitchIdC1 + i] = action(kActionNone);
+        }
+    }
+
+    auto& channel = table[kLayerChannel];
+    for (auto i = 0; i < 16; ++i) {
+        channel[SwitchIds::kSwitchIdC1 + i] = action(kActionChannel, i + 1);
+    }
+    channel[SwitchIds::kSwitchIdOctMinus] = action(kActionLayer, kLayerChannel);
+    channel[SwitchIds::kSwitchIdOctPlus]  = action(kActionLayer, kLayerTranspose);  // together: control, see activeLayer()
+
+    auto& transpose = table[kLayerTranspose];
+    for (auto i = 0; i < config::kNumKeyboardKeys; ++i) {
+        transpose[SwitchIds::kSwitchIdC1 + i] = action(kActionTranspose, i - config::kTransposeCenterKey);
+    }
+    transpose[SwitchIds::kSwitchIdOctMinus] = action(kActionLayer, kLayerChannel);
+    transpose[SwitchIds::kSwitchIdOctPlus]  = action(kActionLayer, kLayerTranspose);
+
+    auto& control = table[kLayerControl];
+    for (auto i = 0u; i < sizeof(config::kSelectableControlNumbers) && i < config::kNumKeyboardKeys; ++i) {
+        control[SwitchIds::kSwitchIdC1 + i] = action(kActionControlNumber, config::kSelectableControlNumbers[i]);
+    }
+    control[SwitchIds::kSwitchIdOctMinus] = action(kActionLayer, kLayerChannel);
+    control[SwitchIds::kSwitchIdOctPlus]  = action(kActionLayer, kLayerTranspose);
+
+    for (auto layer = kLayerBase + 1; layer < kNumLayers; ++layer) {
+        for (auto i = 0u; i < SwitchIds::kNumSwitches; ++i) {
+            if (table[layer][i].type == kActionTransparent) {
+                table[layer][i] = base[i];
+            }
+        }
+    }
+    return table;
+}
+
+inline constexpr KeymapTable kKeymap = buildKeymap();
+
+// resolves switch events to actions through the active layer.
+// the action is latched at press time, so a release always undoes what its press did
+// even if the layer has changed meanwhile (e.g. notes held across a layer switch).
+// a tap/hold switch is a hold once it is held for kTapHoldTermMs, or once another switch is pressed and
+// released while it is held. presses meanwhile wait for the decision, then play on the layer it selects:
+// rolling from an Oct+ tap into the next note plays the note an octave up.
+class Keymap
+{
+public:
+    using ActionHandler = std::function<void(const Action& action, const int off_on)>;
+
+    explicit Keymap(ActionHandler handler = nullptr)
+        : handler_(handler)
+    {
+    }
+
+    void setHandler(ActionHandler handler)
+    {
+        handler_ = handler;
+    }
+
+    // each held layer switch owns its own bit. the control layer is the combination of both,
+    // so releasing either switch falls back to the layer of the one still held.
+    uint8_t activeLayer() const
+    {
+        constexpr auto kControlCombo = (1u << kLayerChannel) | (1u << kLayerTranspose);
+        auto mask                    = layer_mask_;
+        if ((mask & kControlCombo) == kControlCombo) {
+            mask |= (1u << kLayerControl);
+        }
+        return 31 - __builtin_clz(mask | 1u);
+    }
+
+    void switchStateChanged(const uint32_t switch_index, const int off_on, const uint32_t now_ms)
+    {
+        if (switch_index >= SwitchIds::kNumSwitches) {
+            return;
+        }
+
+        if (pending_switch_ != kNoSwitch && pending_switch_ != switch_index) {
+            if (off_on) {
+                if (num_deferred_ < kMaxDeferred) {
+                    deferred_[num_deferred_++] = static_cast<uint8_t>(switch_index);
+                    return;
+                }
+                resolvePending(true, now_ms);  // too much to wait for
+            } else if (isDeferred(switch_index)) {
+                resolvePending(true, now_ms);  // pressed and released while the tap/hold switch is held: hold
+            }
+        }
+
+        if (off_on) {
+            const auto& pressed = kKeymap[activeLayer()][switch_index];
+            pressed_[switch_index] = pressed;
+
+            switch (pressed.type) {
+            case kActionLayerTap:
+                pending_switch_     = switch_index;
+                pending_pressed_at_ = now_ms;
+                if (appliesOnPress(pressed.tap_type)) {
+                    dispatch(action(pressed.tap_type, pressed.tap_value), 1);
+                }
+                return;
+            case kActionLayer:
+                layer_mask_ |= (1u << pressed.value);
+                return;
+            default:
+                dispatch(pressed, 1);
+                return;
+            }
+        }
+
+        if (pending_switch_ == switch_index) {
+            resolvePending(false, now_ms);  // released before it became a hold: tap
+            pressed_[switch_index] = action(kActionNone);
+            return;
+        }
+
+        const auto released    = pressed_[switch_index];
+        pressed_[switch_index] = action(kActionNone);
+
+        switch (released.type) {
+        case kActionLayerTap:
+            layer_mask_ &= ~(1u << released.value);
+            return;
+        case kActionLayer:
+            layer_mask_ &= ~(1u << released.value);
+            return;
+        default:
+            dispatch(released, 0);
+            return;
+        }
+    }
+
+    // call periodically to promote a long press to hold
+    void update(const uint32_t now_ms)
+    {
+        if (pending_switch_ == kNoSwitch) {
+            return;
+        }
+        if (now_ms - pending_pressed_at_ >= config::kTapHoldTermMs) {
+            resolvePending(true, now_ms);
+        }
+    }
+
+protected:
+    enum
+    {
+        kNoSwitch    = SwitchIds::kNumSwitches,
+        kMaxDeferred = 8,
+    };
+
+    // decide the pending tap/hold switch, then play the presses that waited for it
+    void resolvePending(const bool hold, const uint32_t now_ms)
+    {
+        const auto& pending = pressed_[pending_switch_];
+        const auto tap      = action(pending.tap_type, pending.tap_value);
+        pending_switch_     = kNoSwitch;
+        if (hold) {
+            if (appliesOnPress(tap.type)) {
+                dispatch(tap, kActionCancelled);
+            }
+            layer_mask_ |= (1u << pending.value);
+        } else {
+            if (!appliesOnPress(tap.type)) {
+                dispatch(tap, 1);
+            }
+            dispatch(tap, 0);
+        }
+
+        uint8_t deferred[kMaxDeferred];
+        const auto num_deferred = num_deferred_;
+        std::copy(deferred_, deferred_ + num_deferred, deferred);
+        num_deferred_ = 0;
+        for (auto i = 0u; i < num_deferred; ++i) {
+            switchStateChanged(deferred[i], 1, now_ms);  // may start a new tap/hold, the rest waits for that one
+        }
+    }
+
+    bool isDeferred(const uint32_t switch_index) const
+    {
+        return std::find(deferred_, deferred_ + num_deferred_, switch_index) != deferred_ + num_deferred_;
+    }
+
+    void dispatch(const Action& a, const int off_on)
+    {
+        if (a.type == kActionNone || !handler_) {
+            return;
+        }
+        handler_(a, off_on);
+    }
+
+    ActionHandler handler_ = nullptr;
+    Action pressed_[SwitchIds::kNumSwitches]{};
+    uint32_t layer_mask_         = 0;
+    uint32_t pending_switch_     = kNoSwitch;
+    uint32_t pending_pressed_at_ = 0;
+    uint8_t deferred_[kMaxDeferred]{};  // presses waiting for the pending tap/hold switch
+    uint32_t num_deferred_       = 0;
+};
+} // namespace kinoshita_lab::kinoshi_tiny_key_25::keymap
+
+#endif // KEYMAP_HPP
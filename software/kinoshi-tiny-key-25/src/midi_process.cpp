@@ -5,18 +5,273 @@
  * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
  *
  */
-#include "MIDI.h"
 #include <Adafruit_TinyUSB.h>
 #include "midi_process.h"
+#include "midi_transport.hpp"
 #include "config.h"
+#include <algorithm>
 
 namespace kinoshita_lab::kinoshi_tiny_key_25::midi_process
 {
 namespace
 {
 Adafruit_USBD_MIDI usb_midi;
-MIDI_CREATE_INSTANCE(Adafruit_USBD_MIDI, usb_midi, MIDI_USB);
-MIDI_CREATE_INSTANCE(HardwareSerial, Serial2, MIDI_Serial);
+
+// USB link handling
+// while the link is down, USB messages are dropped (DIN keeps playing).
+// every send updates the desired state, every USB write updates what the host has seen.
+// when the link comes back the difference is sent, so no note is stuck or lost.
+enum Reconcile : uint8_t
+{
+    kReconcileNone,
+    kReconcileResume,  // host kept its state over suspend: send the difference
+    kReconcileMount,   // host (re)enumerated: resend everything that should be on
+};
+
+struct ChannelState
+{
+    uint32_t notes[4]           = {0};  // bit per note number
+    uint8_t velocities[128]     = {0};
+    uint32_t controls[4]        = {0};  // bit per control number that has been sent (sustain, modulation...)
+    uint8_t control_values[128] = {0};
+    int16_t pitch_bend          = 0;
+
+    bool noteIsOn(const uint8_t note) const
+    {
+        return testBit(notes, note);
+    }
+    void setNote(const uint8_t note, const bool on)
+    {
+        setBit(notes, note, on);
+    }
+    bool controlIsSet(const uint8_t control_number) const
+    {
+        return testBit(controls, control_number);
+    }
+    void setControl(const uint8_t control_number, const uint8_t value)
+    {
+        setBit(controls, control_number, true);
+        control_values[control_number] = value;
+    }
+
+    static bool testBit(const uint32_t (&bits)[4], const uint8_t index)
+    {
+        return bits[index / 32] & (1u << (index % 32));
+    }
+    static void setBit(uint32_t (&bits)[4], const uint8_t index, const bool on)
+    {
+        if (on) {
+            bits[index / 32] |= (1u << (index % 32));
+        } else {
+            bits[index / 32] &= ~(1u << (index % 32));
+        }
+    }
+};
+constexpr auto kNumChannels = 16;
+ChannelState desired_[kNumChannels];
+ChannelState host_[kNumChannels];
+
+// written from TinyUSB callbacks
+volatile uint8_t reconcile_request_    = kReconcileNone;
+volatile uint32_t link_up_at_us_       = 0;
+volatile bool remote_wakeup_enabled_   = false;
+volatile bool remote_wakeup_requested_ = false;
+
+LinkStatistics link_statistics_;
+bool awaiting_first_message_ = false;  // measuring resume to first message
+
+// sinks
+class UsbSink : public midi_transport::Sink
+{
+public:
+    bool write(const midi_transport::Message& message) override
+    {
+        // USB-MIDI event packet: cable 0, code index number is the status high nibble for channel messages
+        const uint8_t packet[4] = {static_cast<uint8_t>(message.bytes[0] >> 4), message.bytes[0], message.bytes[1], message.bytes[2]};
+        if (!usb_midi.writePacket(packet)) {
+            return false;
+        }
+        trackHost(message);
+        if (awaiting_first_message_) {
+            awaiting_first_message_ = false;
+            recordFirstMessage(micros() - link_up_at_us_);
+        }
+        return true;
+    }
+
+    static void recordFirstMessage(const uint32_t latency_us)
+    {
+        auto& stat                           = link_statistics_;
+        stat.last_resume_to_first_message_us = latency_us;
+        stat.max_resume_to_first_message_us  = std::max(stat.max_resume_to_first_message_us, latency_us);
+        Serial.printf("USB first message after %d us\n", static_cast<int>(latency_us));
+    }
+
+protected:
+    void trackHost(const midi_transport::Message& message)
+    {
+        auto& host = host_[message.channel()];
+        switch (message.type()) {
+        case midi_transport::kTypeNoteOn:
+            host.setNote(message.bytes[1], true);
+            break;
+        case midi_transport::kTypeNoteOff:
+            host.setNote(message.bytes[1], false);
+            break;
+        case midi_transport::kTypeControlChange:
+            host.setControl(message.bytes[1], message.bytes[2]);
+            break;
+        case midi_transport::kTypePitchBend:
+            host.pitch_bend = static_cast<int16_t>((message.bytes[1] | (message.bytes[2] << 7)) - 8192);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+class DinSink : public midi_transport::Sink
+{
+public:
+    enum
+    {
+        kTxFifoSize = 32,                                       // RP2040 UART tx fifo, there is no software buffer
+        kByteTimeUs = 10 * 1000000 / config::kDinMidiBaudRate,  // start + 8 data + stop bits
+    };
+
+    bool write(const midi_transport::Message& message) override
+    {
+        // the UART only tells whether its fifo is full, and writing more than fits blocks until it drains
+        // (up to 640 us for a 3 byte message). the fill level is estimated from the bytes written and the
+        // time it takes to send them, counting the byte in the shift register keeps the estimate on the safe side.
+        const auto now_us  = micros();
+        const auto drained = (now_us - fifo_updated_us_) / kByteTimeUs;
+        if (drained >= fifo_bytes_) {
+            fifo_bytes_      = 0;
+            fifo_updated_us_ = now_us;
+        } else {
+            fifo_bytes_ -= drained;
+            fifo_updated_us_ += drained * kByteTimeUs;
+        }
+        if (kTxFifoSize - fifo_bytes_ < message.length) {
+            return false;
+        }
+        Serial2.write(message.bytes, message.length);
+        fifo_bytes_ += message.length;
+        return true;
+    }
+
+protected:
+    uint32_t fifo_bytes_      = 0;
+    uint32_t fifo_updated_us_ = 0;
+};
+
+UsbSink usb_sink_;
+DinSink din_sink_;
+midi_transport::Transport<config::kMidiPoolSize, kNumSinks> transport_(config::kMidiSinkStallUs);
+bool usb_stalled_ = false;
+
+bool usbLinkUp()
+{
+    if (TinyUSBDevice.mounted() && !TinyUSBDevice.suspended() && reconcile_request_ == kReconcileNone) {
+        return true;
+    }
+    if (TinyUSBDevice.suspended() && remote_wakeup_enabled_ && !remote_wakeup_requested_) {
+        // playing wakes the host up, the message itself comes with the reconcile on resume
+        remote_wakeup_requested_ = true;
+        TinyUSBDevice.remoteWakeup();
+    }
+    return false;
+}
+
+// encode once, every sink reads the same slot
+void publish(const midi_transport::Message& message)
+{
+    auto sinks = static_cast<uint32_t>(decltype(transport_)::kAllSinks);
+    if (!usbLinkUp()) {
+        sinks &= ~(1u << kSinkUsb);
+        transport_.countDropped(kSinkUsb);
+    }
+    transport_.publish(message, sinks);
+}
+
+void reconcile(const bool host_was_reset)
+{
+    // whatever was queued for the old link is stale now, the diff below replaces it
+    transport_.discard(kSinkUsb);
+
+    auto num_messages   = 0u;
+    const auto send_usb = [&](const midi_transport::Message& message) {
+        if (transport_.publish(message, 1u << kSinkUsb)) {
+            num_messages++;
+        }
+    };
+
+    for (auto i = 0; i < kNumChannels; ++i) {
+        const auto channel  = i + 1;
+        const auto& desired = desired_[i];
+        const auto& host    = host_[i];
+        for (auto note = 0; note < 128; ++note) {
+            const auto want = desired.noteIsOn(note);
+            const auto has  = host.noteIsOn(note);
+            if (has && !want) {
+                send_usb(midi_transport::noteOff(note, 0, channel));
+            } else if (want && (!has || host_was_reset)) {
+                send_usb(midi_transport::noteOn(note, desired.velocities[note], channel));
+            }
+        }
+        for (auto control_number = 0; control_number < 128; ++control_number) {
+            if (!desired.controlIsSet(control_number)) {
+                continue;  // never sent, the host has its own default
+            }
+            const auto value = desired.control_values[control_number];
+            if (host_was_reset || !host.controlIsSet(control_number) || host.control_values[control_number] != value) {
+                send_usb(midi_transport::controlChange(control_number, value, channel));
+            }
+        }
+        if (desired.pitch_bend != host.pitch_bend || (host_was_reset && desired.pitch_bend != 0)) {
+            send_usb(midi_transport::pitchBend(desired.pitch_bend, channel));
+        }
+    }
+
+    auto& stat = link_statistics_;
+    stat.reconnects++;
+    stat.last_reconciled_messages = num_messages;
+    Serial.printf("USB %s: reconciling %d messages\n", host_was_reset ? "mounted" : "resumed", static_cast<int>(num_messages));
+    if (num_messages) {
+        awaiting_first_message_ = true;  // measured when the first one is written
+    } else {
+        UsbSink::recordFirstMessage(micros() - link_up_at_us_);
+    }
+}
+}
+
+extern "C" {
+// TinyUSB device callbacks. may run in interrupt context, only flag the work for loop().
+void tud_mount_cb(void)
+{
+    link_up_at_us_     = micros();
+    reconcile_request_ = kReconcileMount;
+}
+
+void tud_umount_cb(void)
+{
+    remote_wakeup_enabled_ = false;
+}
+
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+    remote_wakeup_enabled_   = remote_wakeup_en;
+    remote_wakeup_requested_ = false;
+}
+
+void tud_resume_cb(void)
+{
+    link_up_at_us_ = micros();
+    if (reconcile_request_ == kReconcileNone) {
+        reconcile_request_ = kReconcileResume;
+    }
+}
 }
 void initialize()
 {
@@ -28,17 +283,25 @@ void initialize()
         TinyUSBDevice.begin(0);
     }
 
-    usb_midi.setStringDescriptor(config::kUsbMidiStringDescriptor);
+    // a chain secondary is played through the primary: no MIDI port, its UART belongs to the chain
+    const auto is_secondary = config::kChainRole == config::kChainRoleSecondary;
+    if (!is_secondary) {
+        usb_midi.setStringDescriptor(config::kUsbMidiStringDescriptor);
+        usb_midi.begin();
 
-    MIDI_USB.begin(MIDI_CHANNEL_OMNI);
-    MIDI_USB.setThruFilterMode(midi::Thru::Off);
-    if (TinyUSBDevice.mounted()) {
-        TinyUSBDevice.detach();
-        delay(10);
-        TinyUSBDevice.attach();
+        // the core enumerated with CDC only before setup(). the host reads the configuration descriptor
+        // once per enumeration, so the MIDI interface added above only appears after a re-enumeration.
+        // this is not about note state: tud_mount_cb() reconciles that on every mount, this one included.
+        if (TinyUSBDevice.mounted()) {
+            TinyUSBDevice.detach();
+            delay(10);
+            TinyUSBDevice.attach();
+        }
+        Serial2.begin(config::kDinMidiBaudRate);
     }
-    MIDI_Serial.begin(MIDI_CHANNEL_OMNI);
-    MIDI_Serial.setThruFilterMode(midi::Thru::Off);
+
+    transport_.addSink(&usb_sink_, {config::kUsbMidiEnabled, config::kUsbMidiChannelMask, midi_transport::kTypeMaskAll});
+    transport_.addSink(&din_sink_, {config::kDinMidiEnabled, config::kDinMidiChannelMask, midi_transport::kTypeMaskAll});
 }
 void loop()
 {
@@ -46,43 +309,80 @@ void loop()
     // Manual call tud_task since it isn't called by Core's background
     TinyUSBDevice.task();
 #endif
+    const auto request = reconcile_request_;
+    if (request != kReconcileNone && TinyUSBDevice.mounted() && !TinyUSBDevice.suspended()) {
+        reconcile_request_ = kReconcileNone;
+        reconcile(request == kReconcileMount);
+    }
+    transport_.flush(micros());
+
+    // mounted but the host does not read the endpoint, e.g. powered from a laptop while playing DIN.
+    // the transport skips USB meanwhile. what the host missed is reconciled once it reads again.
+    if (transport_.stalled(kSinkUsb) != usb_stalled_) {
+        usb_stalled_ = !usb_stalled_;
+        Serial.printf("USB MIDI %s\n", usb_stalled_ ? "stalled, host is not reading" : "flowing again");
+        if (!usb_stalled_ && reconcile_request_ == kReconcileNone) {
+            link_up_at_us_     = micros();
+            reconcile_request_ = kReconcileResume;
+        }
+    }
+}
+const LinkStatistics& linkStatistics()
+{
+    return link_statistics_;
+}
+void setSinkFilter(SinkId sink, bool enabled, uint16_t channel_mask, uint8_t type_mask)
+{
+    transport_.setFilter(sink, {enabled, channel_mask, type_mask});
+}
+uint32_t queueDepth(SinkId sink)
+{
+    return transport_.queueDepth(sink);
+}
+uint32_t droppedMessages(SinkId sink)
+{
+    return transport_.dropped(sink);
 }
 void sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel)
 {
-    if (note > 127 || velocity > 127 || channel < 1 || channel > 16) {
+    const auto message = midi_transport::noteOn(note, velocity, channel);
+    if (!message.length) {
         return;
     }
-
-    MIDI_USB.sendNoteOn(note, velocity, channel);
-    MIDI_Serial.sendNoteOn(note, velocity, channel);
+    auto& desired = desired_[channel - 1];
+    desired.setNote(note, true);
+    desired.velocities[note] = velocity;
+    publish(message);
 }
 void sendNoteOff(uint8_t note, uint8_t velocity, uint8_t channel)
 {
-    if (note > 127 || velocity > 127 || channel < 1 || channel > 16) {
+    const auto message = midi_transport::noteOff(note, velocity, channel);
+    if (!message.length) {
         return;
     }
-     
-    MIDI_USB.sendNoteOff(note, velocity, channel);
-    MIDI_Serial.sendNoteOff(note, velocity, channel);
-}
-void sendMoulation(bool on, uint8_t channel)
-{
-    const auto value = on ? 127 : 0;
-    MIDI_USB.sendControlChange(1, value, channel);
-    MIDI_Serial.sendControlChange(1, value, channel);
+    desired_[channel - 1].setNote(note, false);
+    publish(message);
 }
 void sendPitchBend(int16_t value, uint8_t channel)
 {
-    if (value < -8192 || value > 8191 || channel < 1 || channel > 16) {
+    const auto message = midi_transport::pitchBend(value, channel);
+    if (!message.length) {
         return;
     }
-    MIDI_USB.sendPitchBend(value, channel);
-    MIDI_Serial.sendPitchBend(value, channel);
+    desired_[channel - 1].pitch_bend = value;
+    publish(message);
 }
 void sendSustain(bool on, uint8_t channel)
 {
-    const auto value = on ? 127 : 0;
-    MIDI_USB.sendControlChange(64, value, channel);
-    MIDI_Serial.sendControlChange(64, value, channel);
+    sendControlChange(64, on ? 127 : 0, channel);
+}
+void sendControlChange(uint8_t control_number, uint8_t value, uint8_t channel)
+{
+    const auto message = midi_transport::controlChange(control_number, value, channel);
+    if (!message.length) {
+        return;
+    }
+    desired_[channel - 1].setControl(control_number, value);
+    publish(message);
+}
 }
-}
\ No newline at end of file
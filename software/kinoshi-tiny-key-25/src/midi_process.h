@@ -15,11 +15,32 @@ namespace kinoshita_lab::kinoshi_tiny_key_25::midi_process
 void initialize();
 void loop();
 
+enum SinkId
+{
+    kSinkUsb,
+    kSinkDin,
+    kNumSinks,
+};
+
+// per sink routing. channel_mask bit n: channel n + 1, type_mask bit n: midi_transport::MessageType n
+void setSinkFilter(SinkId sink, bool enabled, uint16_t channel_mask, uint8_t type_mask);
+uint32_t queueDepth(SinkId sink);
+uint32_t droppedMessages(SinkId sink);  // includes messages dropped while USB was down
+
+struct LinkStatistics
+{
+    uint32_t reconnects                      = 0;  // mount or resume
+    uint32_t last_reconciled_messages        = 0;
+    uint32_t last_resume_to_first_message_us = 0;
+    uint32_t max_resume_to_first_message_us  = 0;
+};
+const LinkStatistics& linkStatistics();
+
 void sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel);
 void sendNoteOff(uint8_t note, uint8_t velocity, uint8_t channel);
-void sendMoulation(bool on, uint8_t channel);
 void sendPitchBend(int16_t value, uint8_t channel);
 void sendSustain(bool on, uint8_t channel);
+void sendControlChange(uint8_t control_number, uint8_t value, uint8_t channel);
 }  // namespace kinoshita_lab::tiny_kino_key_25::midi_process
 
 #endif  // MIDI_H
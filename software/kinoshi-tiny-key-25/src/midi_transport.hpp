@@ -0,0 +1,382 @@
+/**
+ * @file	midi_transport.hpp
+ * @brief	Encode once, fan out MIDI transport for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef MIDI_TRANSPORT_HPP
+#define MIDI_TRANSPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::midi_transport
+{
+enum MessageType : uint8_t
+{
+    kTypeNoteOff,
+    kTypeNoteOn,
+    kTypeControlChange,
+    kTypePitchBend,
+    kTypeOther,
+    kNumMessageTypes,
+};
+
+enum
+{
+    kTypeMaskAll    = (1u << kNumMessageTypes) - 1,
+    kChannelMaskAll = 0xffff,
+};
+
+// one encoded channel message. length 0: invalid, never published.
+struct Message
+{
+    uint8_t bytes[3] = {0};
+    uint8_t length   = 0;
+
+    MessageType type() const
+    {
+        switch (bytes[0] & 0xf0) {
+        case 0x80:
+            return kTypeNoteOff;
+        case 0x90:
+            return kTypeNoteOn;
+        case 0xb0:
+            return kTypeControlChange;
+        case 0xe0:
+            return kTypePitchBend;
+        default:
+            return kTypeOther;
+        }
+    }
+
+    uint8_t channel() const  // 0-15
+    {
+        return bytes[0] & 0x0f;
+    }
+
+    // continuous values: only the latest one matters, a queued one is replaced instead of queuing another.
+    // notes and switch type controllers (sustain and the other pedals, 64-69) are events and never coalesce.
+    bool coalesces() const
+    {
+        switch (type()) {
+        case kTypePitchBend:
+            return true;
+        case kTypeControlChange:
+            return bytes[1] < 64 || bytes[1] > 69;
+        default:
+            return false;
+        }
+    }
+
+    // same channel and type, and same controller for control changes
+    bool sameTarget(const Message& other) const
+    {
+        return bytes[0] == other.bytes[0] && (type() != kTypeControlChange || bytes[1] == other.bytes[1]);
+    }
+};
+
+// validation happens here, once per event. channel is 1-16.
+constexpr Message encode(const uint8_t status, const uint8_t channel, const uint8_t data1, const uint8_t data2)
+{
+    if (channel < 1 || channel > 16 || data1 > 127 || data2 > 127) {
+        return Message{};
+    }
+    return Message{{static_cast<uint8_t>(status | (channel - 1)), data1, data2}, 3};
+}
+
+constexpr Message noteOn(const uint8_t note, const uint8_t velocity, const uint8_t channel)
+{
+    return encode(0x90, channel, note, velocity);
+}
+
+constexpr Message noteOff(const uint8_t note, const uint8_t velocity, const uint8_t channel)
+{
+    return encode(0x80, channel, note, velocity);
+}
+
+constexpr Message controlChange(const uint8_t control_number, const uint8_t value, const uint8_t channel)
+{
+    return encode(0xb0, channel, control_number, value);
+}
+
+constexpr Message pitchBend(const int16_t value, const uint8_t channel)
+{
+    if (value < -8192 || value > 8191) {
+        return Message{};
+    }
+    const auto raw = static_cast<uint16_t>(value + 8192);
+    return encode(0xe0, channel, raw & 0x7f, (raw >> 7) & 0x7f);
+}
+
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+
+    // false: cannot take it now (backpressure), the same message is offered again on the next flush
+    virtual bool write(const Message& message) = 0;
+};
+
+struct SinkFilter
+{
+    bool enabled          = true;
+    uint16_t channel_mask = kChannelMaskAll;  // bit n: channel n + 1
+    uint8_t type_mask     = kTypeMaskAll;     // bit n: MessageType n
+
+    bool accepts(const Message& message) const
+    {
+        return enabled && (channel_mask & (1u << message.channel())) && (type_mask & (1u << message.type()));
+    }
+};
+
+// messages live in a ring pool. each slot keeps a mask of the sinks that still have to read it
+// (the slot's reference count is the number of bits), and each sink reads with its own cursor.
+// pitch bend and continuous controllers update their queued slot in place, so a slow sink (DIN drains
+// about one message per ms) holds at most one per channel and controller between two notes instead of
+// filling the pool. a value never moves ahead of a note on its channel: the note was played with the old one.
+// a sink that refuses every write for stall_timeout_us has stalled (e.g. a USB host that never reads):
+// its queue is discarded, and from then on everything it refuses, until it takes a message again.
+// so nobody ever waits for it, and the pool does not fill behind it. if the pool still fills, publishing
+// drops the oldest message for the sinks that have not read it, and counts it.
+template <size_t kPoolSize, size_t kMaxSinks>
+class Transport
+{
+    static_assert((kPoolSize & (kPoolSize - 1)) == 0, "pool size must be a power of 2");
+    static_assert(kMaxSinks <= 8, "reader mask is 8 bits");
+
+public:
+    enum
+    {
+        kAllSinks              = (1u << kMaxSinks) - 1,
+        kDefaultStallTimeoutUs = 20 * 1000,
+    };
+
+    explicit Transport(const uint32_t stall_timeout_us = kDefaultStallTimeoutUs)
+        : stall_timeout_us_(stall_timeout_us)
+    {
+    }
+
+    // returns the sink id, kMaxSinks if full
+    size_t addSink(Sink* sink, const SinkFilter& filter = SinkFilter{})
+    {
+        if (num_sinks_ >= kMaxSinks) {
+            return kMaxSinks;
+        }
+        sinks_[num_sinks_] = SinkState{sink, filter, head_};
+        return num_sinks_++;
+    }
+
+    void setFilter(const size_t sink_id, const SinkFilter& filter)
+    {
+        if (sink_id < num_sinks_) {
+            sinks_[sink_id].filter = filter;
+        }
+    }
+
+    // false if the message is invalid or nobody wants it
+    bool publish(const Message& message, const uint32_t sink_mask = kAllSinks)
+    {
+        if (message.length == 0) {
+            return false;
+        }
+        auto readers = 0u;
+        for (auto i = 0u; i < num_sinks_; ++i) {
+            if ((sink_mask & (1u << i)) && sinks_[i].filter.accepts(message)) {
+                readers |= (1u << i);
+            }
+        }
+        if (!readers) {
+            return false;
+        }
+        if (message.coalesces()) {
+            readers = coalesce(message, readers);
+            if (!readers) {
+                return true;
+            }
+        }
+        if (full()) {
+            releaseOldest();
+        }
+        auto& slot   = pool_[head_ & (kPoolSize - 1)];
+        slot.message = message;
+        slot.readers = readers;
+        head_++;
+        return true;
+    }
+
+    void flush(const uint32_t now_us)
+    {
+        for (auto i = 0u; i < num_sinks_; ++i) {
+            auto& sink = sinks_[i];
+            catchUp(sink);
+            const auto bit = (1u << i);
+            while (sink.cursor != head_) {
+                auto& slot = pool_[sink.cursor & (kPoolSize - 1)];
+                if (slot.readers & bit) {
+                    if (!sink.sink->write(slot.message)) {
+                        refused(i, now_us);  // backpressure, keep the cursor here
+                        break;
+                    }
+                    slot.readers &= ~bit;
+                    sink.refusing = false;
+                    sink.stalled  = false;
+                }
+                sink.cursor++;
+            }
+        }
+        while (tail_ != head_ && pool_[tail_ & (kPoolSize - 1)].readers == 0) {
+            tail_++;
+        }
+    }
+
+    // drop everything queued for a sink, e.g. when its link went away
+    void discard(const size_t sink_id)
+    {
+        if (sink_id >= num_sinks_) {
+            return;
+        }
+        auto& sink = sinks_[sink_id];
+        catchUp(sink);
+        const auto bit = (1u << sink_id);
+        for (; sink.cursor != head_; sink.cursor++) {
+            auto& slot = pool_[sink.cursor & (kPoolSize - 1)];
+            if (slot.readers & bit) {
+                slot.readers &= ~bit;
+                sink.dropped++;
+            }
+        }
+    }
+
+    // no room for another message without dropping one
+    bool full() const
+    {
+        return head_ - tail_ >= kPoolSize;
+    }
+
+    // messages waiting for the sink
+    uint32_t queueDepth(const size_t sink_id) const
+    {
+        if (sink_id >= num_sinks_) {
+            return 0;
+        }
+        const auto bit = (1u << sink_id);
+        auto depth     = 0u;
+        for (auto index = tail_; index != head_; ++index) {
+            depth += (pool_[index & (kPoolSize - 1)].readers & bit) ? 1 : 0;
+        }
+        return depth;
+    }
+
+    // refused everything for the stall timeout, cleared by the next message it takes
+    bool stalled(const size_t sink_id) const
+    {
+        return sink_id < num_sinks_ && sinks_[sink_id].stalled;
+    }
+
+    uint32_t dropped(const size_t sink_id) const
+    {
+        return sink_id < num_sinks_ ? sinks_[sink_id].dropped : 0;
+    }
+
+    // counts drops decided outside the transport, e.g. a link that is down at publish time
+    void countDropped(const size_t sink_id)
+    {
+        if (sink_id < num_sinks_) {
+            sinks_[sink_id].dropped++;
+        }
+    }
+
+protected:
+    struct Slot
+    {
+        Message message;
+        uint8_t readers = 0;
+    };
+
+    struct SinkState
+    {
+        Sink* sink                = nullptr;
+        SinkFilter filter;
+        uint32_t cursor           = 0;
+        uint32_t dropped          = 0;
+        uint32_t refused_since_us = 0;
+        bool refusing             = false;
+        bool stalled              = false;
+    };
+
+    // slots before tail_ are gone, a cursor behind it has nothing to read there
+    void catchUp(SinkState& sink) const
+    {
+        if (static_cast<int32_t>(sink.cursor - tail_) < 0) {
+            sink.cursor = tail_;
+        }
+    }
+
+    // update the newest queued message for the same target, per sink: sinks read at their own pace, so each
+    // may have its own slot. returns the readers that still need a new slot: those with nothing queued for the
+    // target since their last note on the channel, and all that are left once a slot is also queued for a sink
+    // that must not get this one.
+    uint32_t coalesce(const Message& message, uint32_t readers)
+    {
+        auto behind_note = 0u;  // sinks with a note on the channel queued after the slots seen so far
+        for (auto index = head_; index != tail_ && readers;) {
+            auto& slot = pool_[--index & (kPoolSize - 1)];
+            if (!slot.readers) {
+                continue;
+            }
+            if (!slot.message.coalesces() && slot.message.channel() == message.channel()) {
+                behind_note |= slot.readers;
+                continue;
+            }
+            if (!slot.message.sameTarget(message)) {
+                continue;
+            }
+            if (slot.readers & (~readers | behind_note)) {
+                break;
+            }
+            slot.message = message;
+            readers &= ~slot.readers;
+        }
+        return readers;
+    }
+
+    void refused(const size_t sink_id, const uint32_t now_us)
+    {
+        auto& sink = sinks_[sink_id];
+        if (!sink.refusing) {
+            sink.refusing         = true;
+            sink.refused_since_us = now_us;
+        }
+        if (sink.stalled || now_us - sink.refused_since_us >= stall_timeout_us_) {
+            sink.stalled = true;
+            discard(sink_id);
+        }
+    }
+
+    void releaseOldest()
+    {
+        auto& slot = pool_[tail_ & (kPoolSize - 1)];
+        for (auto i = 0u; i < num_sinks_; ++i) {
+            if (slot.readers & (1u << i)) {
+                sinks_[i].dropped++;
+            }
+        }
+        slot.readers = 0;
+        tail_++;
+        while (tail_ != head_ && pool_[tail_ & (kPoolSize - 1)].readers == 0) {
+            tail_++;
+        }
+    }
+
+    Slot pool_[kPoolSize];
+    SinkState sinks_[kMaxSinks];
+    size_t num_sinks_ = 0;
+    uint32_t head_    = 0;  // next slot to write
+    uint32_t tail_    = 0;  // oldest slot still referenced
+    uint32_t stall_timeout_us_;
+};
+} // namespace kinoshita_lab::kinoshi_tiny_key_25::midi_transport
+
+#endif // MIDI_TRANSPORT_HPP
@@ -23,6 +23,8 @@ enum
 
     kPinZeroNeoPixel = D16,
     kPinOctaveNeoPixel = D29,
+
+    kPinChainRx = D1,  // UART0 RX, hand wired to UART1 TX of the next unit down the chain
 };
 
 } // namespace kinoshita_lab::tiny_kino_key_25
@@ -0,0 +1,144 @@
+/**
+ * @file	scan_governor.cpp
+ * @brief	Adaptive scan rate and idle sleep for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <Arduino.h>
+#include <algorithm>
+#include <hardware/sync.h>
+#include "scan_governor.h"
+#include "config.h"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::scan_governor
+{
+namespace
+{
+constexpr uint32_t kScanPeriodUs[kNumModes] = {
+    config::kIdleScanPeriodUs,
+    config::kActiveScanPeriodUs,
+};
+constexpr const char* kModeNames[kNumModes] = {
+    "idle",
+    "active",
+};
+
+Mode mode_                        = kModeIdle;
+uint32_t last_activity_us_        = 0;
+uint32_t last_account_us_         = 0;
+uint64_t mode_elapsed_us_         = 0;  // 64 bit: micros() wraps after 71 minutes, a long idle must not
+uint64_t mode_sleep_us_           = 0;
+Statistics statistics_[kNumModes] = {};
+
+// called at least every few ms (update() runs from the governor task), so the 32 bit difference never wraps
+void account(const uint32_t now_us)
+{
+    mode_elapsed_us_ += now_us - last_account_us_;
+    last_account_us_ = now_us;
+}
+
+int permille(const uint64_t part, const uint64_t whole)
+{
+    return whole ? static_cast<int>(part * 1000 / whole) : 0;
+}
+
+void setMode(const Mode new_mode, const uint32_t now_us)
+{
+    if (new_mode == mode_) {
+        return;
+    }
+    // account the mode we are leaving. the duty cycle is what the power draw follows.
+    account(now_us);
+    auto& stat = statistics_[mode_];
+    stat.elapsed_us += mode_elapsed_us_;
+    stat.sleep_us += mode_sleep_us_;
+    const auto awake = permille(mode_elapsed_us_ - std::min(mode_sleep_us_, mode_elapsed_us_), mode_elapsed_us_);
+    Serial.printf("Scan governor: %s -> %s (%s for %lu ms, awake %d.%d%%)\n",
+                  kModeNames[mode_], kModeNames[new_mode], kModeNames[mode_],
+                  static_cast<unsigned long>(mode_elapsed_us_ / 1000), awake / 10, awake % 10);
+
+    mode_            = new_mode;
+    mode_elapsed_us_ = 0;
+    mode_sleep_us_   = 0;
+}
+}
+
+void initialize(const uint32_t now_us)
+{
+    mode_             = kModeIdle;
+    last_activity_us_ = now_us;
+    last_account_us_  = now_us;
+    mode_elapsed_us_  = 0;
+    mode_sleep_us_    = 0;
+}
+
+void notifyActivity(const uint32_t now_us)
+{
+    last_activity_us_ = now_us;
+    setMode(kModeActive, now_us);
+}
+
+uint32_t update(const uint32_t now_us, const bool any_switch_on)
+{
+    account(now_us);
+    if (any_switch_on) {
+        last_activity_us_ = now_us;
+    }
+    if (mode_ == kModeActive && (now_us - last_activity_us_) >= config::kActiveHoldTimeUs) {
+        setMode(kModeIdle, now_us);
+    }
+    return kScanPeriodUs[mode_];
+}
+
+void sleep()
+{
+    if (!config::kSleepBetweenScans) {
+        return;
+    }
+    // the application timer fires every kApplicationTimerIntervalUs, so this never oversleeps a scan by more than that
+    const auto start = micros();
+    __wfi();
+    mode_sleep_us_ += micros() - start;
+}
+
+void recordPressLatency(const Mode mode, const uint32_t latency_us)
+{
+    if (mode >= kNumModes) {
+        return;
+    }
+    auto& stat = statistics_[mode];
+    stat.presses++;
+    stat.press_latency_total_us += latency_us;
+    stat.press_latency_max_us = std::max(stat.press_latency_max_us, latency_us);
+}
+
+void logStatistics()
+{
+    static uint32_t reported_presses[kNumModes] = {0};
+    for (auto i = 0; i < kNumModes; ++i) {
+        const auto& stat = statistics_[i];
+        if (stat.presses == reported_presses[i]) {
+            continue;
+        }
+        reported_presses[i] = stat.presses;
+        // the current mode's running time is not in its statistics yet
+        const auto elapsed = stat.elapsed_us + (i == mode_ ? mode_elapsed_us_ : 0);
+        const auto sleep   = stat.sleep_us + (i == mode_ ? mode_sleep_us_ : 0);
+        const auto awake   = permille(elapsed - std::min(sleep, elapsed), elapsed);
+        Serial.printf("Scan governor %s: %lu s, awake %d.%d%%, %d presses, press to send avg %d us max %d us\n",
+                      kModeNames[i], static_cast<unsigned long>(elapsed / 1000000), awake / 10, awake % 10,
+                      static_cast<int>(stat.presses), static_cast<int>(stat.press_latency_total_us / stat.presses),
+                      static_cast<int>(stat.press_latency_max_us));
+    }
+}
+
+Mode mode()
+{
+    return mode_;
+}
+
+const Statistics& statistics(const Mode mode)
+{
+    return statistics_[mode];
+}
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::scan_governor
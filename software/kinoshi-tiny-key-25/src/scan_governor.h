@@ -0,0 +1,55 @@
+/**
+ * @file	scan_governor.h
+ * @brief	Adaptive scan rate and idle sleep for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef SCAN_GOVERNOR_H
+#define SCAN_GOVERNOR_H
+
+#include <cstdint>
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::scan_governor
+{
+enum Mode
+{
+    kModeIdle,
+    kModeActive,
+    kNumModes,
+};
+
+struct Statistics
+{
+    uint64_t elapsed_us = 0;  // time spent in the mode
+    uint64_t sleep_us   = 0;  // part of elapsed_us spent in __wfi
+
+    // key presses detected while in the mode, press to note on sent.
+    // the press is only known to be after the last scan that did not see it, so this is an upper bound.
+    uint32_t presses                = 0;
+    uint64_t press_latency_total_us = 0;
+    uint32_t press_latency_max_us   = 0;
+};
+
+void initialize(const uint32_t now_us);
+
+// call on every switch change
+void notifyActivity(const uint32_t now_us);
+
+// returns the scan period for the current mode
+uint32_t update(const uint32_t now_us, const bool any_switch_on);
+
+// sleep until the next interrupt (application timer or USB)
+void sleep();
+
+// a key press detected in the mode has been sent
+void recordPressLatency(const Mode mode, const uint32_t latency_us);
+
+// per mode awake time and press latency, if anything changed since the last call
+void logStatistics();
+
+Mode mode();
+const Statistics& statistics(const Mode mode);
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::scan_governor
+
+#endif  // SCAN_GOVERNOR_H
@@ -0,0 +1,198 @@
+/**
+ * @file	scheduler.hpp
+ * @brief	Cooperative task scheduler for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <Arduino.h>
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::scheduler
+{
+enum Priority
+{
+    kPriorityInput,         // scan -> dispatch -> USB, all due tasks run on every pass
+    kPriorityHousekeeping,  // LEDs, logging... at most one per pass, earliest deadline first
+};
+
+// period of a task that is left in the table but never runs, e.g. when its feature is configured out
+constexpr uint32_t kPeriodDisabled = UINT32_MAX;
+
+struct Task
+{
+    const char* name;
+    void (*function)();
+    uint32_t period_ticks;  // 0: run on every pass, kPeriodDisabled: never
+    uint32_t deadline_us;   // from release to completion
+    Priority priority;
+};
+
+struct TaskStatistics
+{
+    uint32_t runs            = 0;
+    uint32_t overruns        = 0;  // deadline missed or release skipped
+    uint32_t max_exec_us     = 0;
+    uint32_t max_response_us = 0;
+};
+
+template <size_t N>
+constexpr bool isSortedByPriority(const Task (&tasks)[N])
+{
+    for (auto i = 1u; i < N; ++i) {
+        if (tasks[i].priority < tasks[i - 1].priority) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// static table scheduler, ticks come from the application timer
+template <size_t N>
+class Scheduler
+{
+public:
+    Scheduler(const Task (&tasks)[N], const uint32_t tick_interval_us)
+        : tasks_(tasks), tick_interval_us_(tick_interval_us)
+    {
+        for (auto i = 0u; i < N; ++i) {
+            period_ticks_[i] = tasks[i].period_ticks;
+        }
+    }
+
+    // release every periodic task now
+    void start()
+    {
+        const auto now = ticks();
+        for (auto i = 0u; i < N; ++i) {
+            next_release_[i] = now;
+        }
+    }
+
+    // call from the timer ISR
+    void tick()
+    {
+        ticks_ = ticks_ + 1;
+    }
+
+    uint32_t ticks() const
+    {
+        return ticks_;
+    }
+
+    void setPeriodTicks(const size_t task_id, const uint32_t period_ticks)
+    {
+        if (task_id >= N || period_ticks_[task_id] == period_ticks || period_ticks_[task_id] == kPeriodDisabled) {
+            return;
+        }
+        // keep the phase, just move the next release
+        next_release_[task_id] += period_ticks - period_ticks_[task_id];
+        period_ticks_[task_id] = period_ticks;
+    }
+
+    // true if a periodic task is released. polling tasks (period 0) don't count, they run on every pass anyway.
+    bool hasDueTask() const
+    {
+        const auto now = ticks();
+        for (auto i = 0u; i < N; ++i) {
+            if (period_ticks_[i] && isReleased(i, now)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // one scheduler pass
+    void run()
+    {
+        const auto now = ticks();
+
+        auto housekeeping       = N;
+        auto housekeeping_slack = int32_t(0);
+        for (auto i = 0u; i < N; ++i) {
+            if (!isReleased(i, now)) {
+                continue;
+            }
+            if (tasks_[i].priority == kPriorityInput) {
+                execute(i, now);
+                continue;
+            }
+            // earliest absolute deadline first. deadlines are compared relative to now to survive wrap around.
+            const auto release_us = (now - next_release_[i]) * tick_interval_us_;
+            const auto slack      = static_cast<int32_t>(tasks_[i].deadline_us - release_us);
+            if (housekeeping == N || slack < housekeeping_slack) {
+                housekeeping       = i;
+                housekeeping_slack = slack;
+            }
+        }
+        if (housekeeping < N) {
+            execute(housekeeping, ticks());
+        }
+    }
+
+    const TaskStatistics& statistics(const size_t task_id) const
+    {
+        return statistics_[task_id];
+    }
+
+    const Task& task(const size_t task_id) const
+    {
+        return tasks_[task_id];
+    }
+
+    static constexpr size_t numTasks()
+    {
+        return N;
+    }
+
+protected:
+    bool isReleased(const size_t i, const uint32_t now) const
+    {
+        if (period_ticks_[i] == kPeriodDisabled) {
+            return false;
+        }
+        return period_ticks_[i] == 0 || static_cast<int32_t>(now - next_release_[i]) >= 0;
+    }
+
+    void execute(const size_t i, const uint32_t now)
+    {
+        const auto late_ticks = period_ticks_[i] ? now - next_release_[i] : 0;
+        const auto start      = micros();
+        tasks_[i].function();
+        const uint32_t exec_us = micros() - start;
+
+        auto& stat          = statistics_[i];
+        const auto response = late_ticks * tick_interval_us_ + exec_us;
+        stat.runs++;
+        stat.max_exec_us     = std::max<uint32_t>(stat.max_exec_us, exec_us);
+        stat.max_response_us = std::max<uint32_t>(stat.max_response_us, response);
+        if (response > tasks_[i].deadline_us) {
+            stat.overruns++;
+        }
+
+        if (period_ticks_[i] == 0) {
+            return;
+        }
+        next_release_[i] += period_ticks_[i];
+        if (static_cast<int32_t>(ticks() - next_release_[i]) >= 0) {
+            // fell behind a whole period: skip the missed releases instead of bursting
+            stat.overruns++;
+            next_release_[i] = ticks() + period_ticks_[i];
+        }
+    }
+
+    const Task (&tasks_)[N];
+    const uint32_t tick_interval_us_;
+    volatile uint32_t ticks_ = 0;
+    uint32_t period_ticks_[N]{};
+    uint32_t next_release_[N]{};
+    TaskStatistics statistics_[N]{};
+};
+} // namespace kinoshita_lab::kinoshi_tiny_key_25::scheduler
+
+#endif // SCHEDULER_HPP
@@ -11,71 +11,47 @@
 #include <cstdint>
 #include <cstdlib>
 #include <Arduino.h>
+#include <pico/stdlib.h>
 #include <functional>
+#include <algorithm>
+#include "switch_ids.h"
 namespace kinoshita_lab::kinoshi_tiny_key_25::switches
 {
 // product specific switch scanner
-class Switches
+class Switches : public SwitchIds
 {
 public:
-    enum SwitchIds
-    {
-        kSwitchIdC1 = 0,
-
-        kSwitchIdGs1,
-        kSwitchIdG1,
-        kSwitchIdFs1,
-        kSwitchIdF1,
-        kSwitchIdE1,
-        kSwitchIdDs1,
-        kSwitchIdD1,
-        kSwitchIdCs1,
-
-        kSwitchIdE2,
-        kSwitchIdDs2,
-        kSwitchIdD2,
-        kSwitchIdCs2,
-        kSwitchIdC2,
-        kSwitchIdB1,
-        kSwitchIdAs1,
-        kSwitchIdA1,
-
-        kSwitchIdC3,
-        kSwitchIdB2,
-        kSwitchIdAs2,
-        kSwitchIdA2,
-        kSwitchIdGs2,
-        kSwitchIdG2,
-        kSwitchIdFs2,
-        kSwitchIdF2,
-
-        kSwitchIdSustain,
-        kSwitchIdPitchBendPlus,
-        kSwitchIdPitchBendMinus,
-        kSwitchIdModulation,
-        kSwitchIdOctMinus,
-        kSwitchIdOctPlus,
-
-        kNumSwitches,
-    };
-
     enum
     {                                 // misc. constants
         kNumRequiredClockCycles = 16, // U4, U5 is cascaded, so 16 clock cycles are required to read all switches
         kScanPeriod             = 10, // ms
+        kNumChains              = 3,  // SerialOut1, 2, 3
 
+        // spare bits with known levels, checked on every frame to detect corrupted reads
+        kChain3SentinelHighMask = 0xff03, // U2 D7/D6 and U2 DS are pulled up
+        kChain1RepeatMask       = 0xfe00, // KEY_C1 is on U3 DS, so bits 9-15 repeat bit 8
+        kChain1RepeatSourceBit  = 8,
+
+        // clock calibration
+        kMaxEdgeDelayCycles        = 256,
+        kCalibrationFramesPerStep  = 256,
+        kCalibrationNoFailure      = 0xffffffff,
+        kCalibrationNoErrorFree    = 0xffffffff,
+        kCalibrationFallbackCycles = 4 * kMaxEdgeDelayCycles,  // used when even the slowest step has errors
     };
-    using SwitchHandler = std::function<void(uint32_t switch_index, const int off_on)>;
 
-    enum InternalState
+    struct ClockCalibration
     {
-        Init,
-        LoadStart,
-        ReadEachBits,
-        WaitNext,
-        NumNormalStates,
-        UnknownState = 0xff,
+        uint32_t fastest_error_free_cycles = kCalibrationNoErrorFree;  // kCalibrationNoErrorFree if every step failed
+        uint32_t first_failing_cycles      = kCalibrationNoFailure;    // kCalibrationNoFailure if it never failed
+        uint32_t operating_cycles          = kMaxEdgeDelayCycles;
+
+        bool failed() const
+        {
+            return fastest_error_free_cycles == kCalibrationNoErrorFree;
+        }
     };
+    using SwitchHandler = std::function<void(uint32_t switch_index, const int off_on)>;
 
     Switches(
         const uint8_t npl_pin, const uint8_t clock_pin,
@@ -86,9 +62,8 @@ public:
 
         // initialize switch status
         for (auto i = 0u; i < kNumSwitches; ++i) {
-            scan_buffers_[i]        = 1;
-            former_scan_buffers_[i] = 1;
-            switch_status_[i]       = 1;
+            scan_buffers_[i]  = 1;
+            switch_status_[i] = 1;
         }
         pinMode(npl_pin, OUTPUT);
         pinMode(clock_pin, OUTPUT);
@@ -96,7 +71,7 @@ public:
         pinMode(output2_pin, INPUT_PULLUP);
         pinMode(output3_pin, INPUT_PULLUP);
 
-        setState(Init);
+        setIdleLevels();
     }
 
     void setHandler(SwitchHandler handler)
@@ -210,68 +185,114 @@ public:
         return kNumSwitches; // out of range
     }
 
-    void update()
+    // load and read one frame. the scheduler decides when, see scan_governor
+    void scan()
     {
-        switch (status_) {
-        case Init:
-            setState(LoadStart);
-            break;
-        case LoadStart:
-            setState(ReadEachBits);
-            break;
-        case ReadEachBits: {
-            for (auto ic_index = 0u; ic_index < kNumRequiredClockCycles / 8; ic_index++) {
-                constexpr auto num_bits = 8;
-                for (auto i = 0u; i < num_bits; ++i) {
-                    digitalWrite(pins_.clock_pin, LOW);
-                    const auto read1_data = digitalRead(pins_.output1_pin);
-                    const auto read2_data = digitalRead(pins_.output2_pin);
-                    const auto read3_data = digitalRead(pins_.output3_pin);
-                    const auto switch1Id  = toSwitchId(ic_index, i, 0);
-                    const auto switch2Id  = toSwitchId(ic_index, i, 1);
-                    const auto switch3Id  = toSwitchId(ic_index, i, 2);
-
-                    if (switch1Id < kNumSwitches) {
-                        scan_buffers_[switch1Id] = read1_data;
-                    }
-                    if (switch2Id < kNumSwitches) {
-                        scan_buffers_[switch2Id] = read2_data;
-                    }
-                    if (switch3Id < kNumSwitches) {
-                        scan_buffers_[switch3Id] = read3_data;
-                    }
-                    if (read3_data == LOW) {
-                    //    Serial.printf("bit:%d read3_data: %d => switch id %d\n", i, read3_data, switch3Id);
-                    }
-
-                    digitalWrite(pins_.clock_pin, HIGH);
+        loadParallel();
+        processFrame();
+    }
+
+    // initial read at boot, before the scheduler runs: enough frames for the debounce to take every level
+    void forceScan()
+    {
+        constexpr auto kNumFrames = config::kDebounceTimeUs / (kScanPeriod * 1000) + 2;
+        for (auto i = 0u; i < kNumFrames; ++i) {
+            scan();
+            delay(kScanPeriod);
+        }
+    }
+
+    // step the clock up (shorter edge delay) until sentinel errors appear,
+    // then run one step slower than the fastest error-free setting.
+    ClockCalibration calibrateClock(const uint32_t num_frames_per_step = kCalibrationFramesPerStep)
+    {
+        ClockCalibration result;
+        auto cycles = static_cast<uint32_t>(kMaxEdgeDelayCycles);
+        while (true) {
+            edge_delay_cycles_ = cycles;
+            auto errors        = 0u;
+            for (auto i = 0u; i < num_frames_per_step; ++i) {
+                loadParallel();
+                readFrame();
+                if (!frameIsValid()) {
+                    errors++;
                 }
             }
-            updateSwitchStatus();
-            setState(WaitNext);
-            break;
-        case WaitNext: {
-            const auto current = millis();
-            const auto delta   = current - wait_start_;
-            if (delta >= kScanPeriod) {
-                setState(LoadStart);
+            if (errors) {
+                result.first_failing_cycles = cycles;
+                break;
+            }
+            result.fastest_error_free_cycles = cycles;
+            if (cycles == 0) {
+                break;
             }
-        } break;
-        default:
-            break;
+            cycles /= 2;
         }
+
+        if (result.failed()) {
+            // no setting was error free: don't trust any of them, run well below the tested range.
+            // the sentinel check itself may be what is wrong on this board, and dropping every frame
+            // would leave a dead keyboard: decode them all, failures are still counted.
+            result.operating_cycles = kCalibrationFallbackCycles;
+            validate_frames_        = false;
+        } else if (result.first_failing_cycles == kCalibrationNoFailure) {
+            result.operating_cycles = result.fastest_error_free_cycles;  // could not make it fail
+        } else {
+            result.operating_cycles = std::min<uint32_t>(std::max<uint32_t>(result.fastest_error_free_cycles * 2, 1), kMaxEdgeDelayCycles);
         }
-    };
+        edge_delay_cycles_ = result.operating_cycles;
+        calibration_       = result;
+        setIdleLevels();
+        return result;
+    }
 
-    void forceScan()
+    void setEdgeDelayCycles(const uint32_t cycles)
     {
-        // scan 2 times just in case for robustness
-        for (auto i = 0; i < 4; ++i) {
-            for (auto i = 0; i < NumNormalStates; ++i) {
-                update();
-                delay(kScanPeriod);
-            }
+        edge_delay_cycles_ = cycles;
+    }
+
+    uint32_t edgeDelayCycles() const
+    {
+        return edge_delay_cycles_;
+    }
+
+    const ClockCalibration& clockCalibration() const
+    {
+        return calibration_;
+    }
+
+    uint32_t scannedFrames() const
+    {
+        return scanned_frames_;
+    }
+
+    // frames that failed the sentinel check. discarded while validating, decoded anyway when not.
+    uint32_t corruptedFrames() const
+    {
+        return corrupted_frames_;
+    }
+
+    // false after a failed clock calibration
+    bool validatesFrames() const
+    {
+        return validate_frames_;
+    }
+
+    // read in a switch handler: the change being notified happened after this time,
+    // the last frame that still saw the old level.
+    uint32_t changeWindowStartUs() const
+    {
+        return change_window_start_us_;
+    }
+
+    // bit n: switch id n is on
+    uint32_t packedState() const
+    {
+        auto packed = 0u;
+        for (auto i = 0u; i < kNumSwitches; ++i) {
+            packed |= (switch_status_[i] == 0 ? 1u : 0u) << i;
         }
+        return packed;
     }
 
     bool switchIsOn(const uint32_t switch_index) const
@@ -284,60 +305,119 @@ public:
     }
 
 protected:
-    uint8_t status_          = UnknownState;
-    size_t will_read_switch_ = 0;
-
-    void setState(const int status)
+    // between frames: shift mode, clock low
+    void setIdleLevels()
     {
-        status_ = status;
         assert(pins_.npl_pin != Pins::INVALID_PIN_CONFIGURATION);
         assert(pins_.clock_pin != Pins::INVALID_PIN_CONFIGURATION);
         assert(pins_.output1_pin != Pins::INVALID_PIN_CONFIGURATION);
         assert(pins_.output2_pin != Pins::INVALID_PIN_CONFIGURATION);
         assert(pins_.output3_pin != Pins::INVALID_PIN_CONFIGURATION);
 
-        switch (status_) {
-        case Init:
-            digitalWrite(pins_.npl_pin, HIGH);
-            digitalWrite(pins_.clock_pin, LOW);
-            break;
-        case LoadStart:
-            digitalWrite(pins_.npl_pin, LOW);
-            digitalWrite(pins_.clock_pin, LOW);
-            will_read_switch_ = 0;
-            break;
-        case ReadEachBits:
-            digitalWrite(pins_.clock_pin, LOW);
-            digitalWrite(pins_.npl_pin, HIGH);
-            break;
-        case WaitNext:
-            wait_start_ = millis();
-            digitalWrite(pins_.npl_pin, HIGH);
+        digitalWrite(pins_.npl_pin, HIGH);
+        digitalWrite(pins_.clock_pin, LOW);
+    }
+
+    void waitEdge() const
+    {
+        if (edge_delay_cycles_) {
+            busy_wait_at_least_cycles(edge_delay_cycles_);
+        }
+    }
+
+    // nPL pulse before every frame
+    void loadParallel()
+    {
+        digitalWrite(pins_.clock_pin, LOW);
+        digitalWrite(pins_.npl_pin, LOW);
+        waitEdge();
+        digitalWrite(pins_.npl_pin, HIGH);
+        waitEdge();
+    }
+
+    void readFrame()
+    {
+        for (auto chain = 0u; chain < kNumChains; ++chain) {
+            frame_[chain] = 0;
+        }
+        for (auto bit = 0u; bit < kNumRequiredClockCycles; ++bit) {
             digitalWrite(pins_.clock_pin, LOW);
-            break;
-        default:
-            break;
+            waitEdge();
+            frame_[0] |= (digitalRead(pins_.output1_pin) ? 1u : 0u) << bit;
+            frame_[1] |= (digitalRead(pins_.output2_pin) ? 1u : 0u) << bit;
+            frame_[2] |= (digitalRead(pins_.output3_pin) ? 1u : 0u) << bit;
+            digitalWrite(pins_.clock_pin, HIGH);
+            waitEdge();
         }
     }
 
-    void updateSwitchStatus()
+    bool frameIsValid() const
     {
-        for (auto i = 0u; i < kNumSwitches; ++i) {
-            if (scan_buffers_[i] == former_scan_buffers_[i]) {
-                const auto new_status = scan_buffers_[i];
-                auto current_status   = switch_status_[i];
-                if (current_status != new_status) {
-                    switch_status_[i] = (new_status);
-
-                    const auto notification_status = !switch_status_[i]; // NOTE: inverted!! off = HIGH, on = LOW
-                    if (handler_) {
-                        handler_(i, notification_status);
-                    } else {
-                        Serial.printf("Switch %d is %s\n", i, notification_status ? "ON" : "OFF");
-                    }
+        if ((frame_[2] & kChain3SentinelHighMask) != kChain3SentinelHighMask) {
+            return false;
+        }
+        const auto c1       = (frame_[0] >> kChain1RepeatSourceBit) & 1u;
+        const auto expected = c1 ? kChain1RepeatMask : 0u;
+        return (frame_[0] & kChain1RepeatMask) == expected;
+    }
+
+    void processFrame()
+    {
+        readFrame();
+        scanned_frames_++;
+        if (!frameIsValid()) {
+            corrupted_frames_++;
+            if (validate_frames_) {
+                return;  // discard, switch status keeps the last good frame
+            }
+        }
+        decodeFrame();
+    }
+
+    void decodeFrame()
+    {
+        for (auto bit = 0u; bit < kNumRequiredClockCycles; ++bit) {
+            const auto ic_index  = bit / 8;
+            const auto bit_index = bit % 8;
+            for (auto chain = 0u; chain < kNumChains; ++chain) {
+                const auto switch_id = toSwitchId(ic_index, bit_index, chain);
+                if (switch_id < kNumSwitches) {
+                    scan_buffers_[switch_id] = (frame_[chain] >> bit) & 1u;
                 }
             }
-            former_scan_buffers_[i] = scan_buffers_[i];
+        }
+        const auto now_us = micros();
+        updateSwitchStatus(now_us);
+        last_frame_us_ = now_us;
+    }
+
+    // debounce by time, not by frames: a new level is taken once every frame has seen it for kDebounceTimeUs,
+    // so bounces are filtered the same at 1 kHz and at 100 Hz scanning.
+    void updateSwitchStatus(const uint32_t now_us)
+    {
+        for (auto i = 0u; i < kNumSwitches; ++i) {
+            if (scan_buffers_[i] == switch_status_[i]) {
+                changing_[i] = false;  // bounced back
+                continue;
+            }
+            if (!changing_[i]) {
+                changing_[i]          = true;
+                changing_since_us_[i] = now_us;
+                changing_after_us_[i] = last_frame_us_;
+            }
+            if (now_us - changing_since_us_[i] < config::kDebounceTimeUs) {
+                continue;
+            }
+            changing_[i]            = false;
+            switch_status_[i]       = scan_buffers_[i];
+            change_window_start_us_ = changing_after_us_[i];
+
+            const auto notification_status = !switch_status_[i]; // NOTE: inverted!! off = HIGH, on = LOW
+            if (handler_) {
+                handler_(i, notification_status);
+            } else {
+                Serial.printf("Switch %d is %s\n", i, notification_status ? "ON" : "OFF");
+            }
         }
     }
     struct Pins
@@ -362,9 +442,18 @@ protected:
     SwitchHandler handler_ = nullptr;
 
     uint8_t scan_buffers_[kNumSwitches]        = {0};
-    uint8_t former_scan_buffers_[kNumSwitches] = {0};
     uint8_t switch_status_[kNumSwitches]       = {0};
-    uint32_t wait_start_                       = 0;
+    bool changing_[kNumSwitches]               = {false};  // the scanned level differs from switch_status_
+    uint32_t changing_since_us_[kNumSwitches]  = {0};      // first frame that saw the new level
+    uint32_t changing_after_us_[kNumSwitches]  = {0};      // last frame that saw the old level
+    uint16_t frame_[kNumChains]                = {0};
+    uint32_t edge_delay_cycles_                = 0;
+    uint32_t scanned_frames_                   = 0;
+    uint32_t corrupted_frames_                 = 0;
+    bool validate_frames_                      = true;
+    uint32_t last_frame_us_                    = 0;
+    uint32_t change_window_start_us_           = 0;
+    ClockCalibration calibration_;
 
 private:
     Switches(const Switches&) {}
@@ -0,0 +1,59 @@
+/**
+ * @file	switch_ids.h
+ * @brief	Switch numbering for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef SWITCH_IDS_H
+#define SWITCH_IDS_H
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::switches
+{
+// shared by the scanner and the keymap. no hardware dependency, so the keymap builds on the host.
+struct SwitchIds
+{
+    enum Id
+    {
+        kSwitchIdC1 = 0,
+
+        kSwitchIdGs1,
+        kSwitchIdG1,
+        kSwitchIdFs1,
+        kSwitchIdF1,
+        kSwitchIdE1,
+        kSwitchIdDs1,
+        kSwitchIdD1,
+        kSwitchIdCs1,
+
+        kSwitchIdE2,
+        kSwitchIdDs2,
+        kSwitchIdD2,
+        kSwitchIdCs2,
+        kSwitchIdC2,
+        kSwitchIdB1,
+        kSwitchIdAs1,
+        kSwitchIdA1,
+
+        kSwitchIdC3,
+        kSwitchIdB2,
+        kSwitchIdAs2,
+        kSwitchIdA2,
+        kSwitchIdGs2,
+        kSwitchIdG2,
+        kSwitchIdFs2,
+        kSwitchIdF2,
+
+        kSwitchIdSustain,
+        kSwitchIdPitchBendPlus,
+        kSwitchIdPitchBendMinus,
+        kSwitchIdModulation,
+        kSwitchIdOctMinus,
+        kSwitchIdOctPlus,
+
+        kNumSwitches,
+    };
+};
+} // namespace kinoshita_lab::kinoshi_tiny_key_25::switches
+
+#endif // SWITCH_IDS_H
@@ -0,0 +1,68 @@
+/**
+ * @file	telemetry.cpp
+ * @brief	Binary telemetry stream over USB CDC for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <Arduino.h>
+#include "telemetry.h"
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::telemetry
+{
+namespace
+{
+// double buffer: one frame waiting for room on the wire, the other one filled by the next snapshot
+Frame frames_[2];
+uint8_t sending_         = 0;
+bool pending_            = false;  // the other frame is committed and waits for the wire
+uint16_t sequence_       = 0;
+uint16_t dropped_frames_ = 0;
+}
+
+Frame& beginSnapshot()
+{
+    return frames_[sending_ ^ 1];
+}
+
+void commitSnapshot()
+{
+    auto& frame = frames_[sending_ ^ 1];
+    if (pending_) {
+        dropped_frames_++;  // the previous snapshot never made it to the wire
+    }
+    frame.magic[0]       = kMagic0;
+    frame.magic[1]       = kMagic1;
+    frame.version        = kVersion;
+    frame.length         = sizeof(Frame);
+    frame.sequence       = sequence_++;
+    frame.dropped_frames = dropped_frames_;
+    frame.checksum       = 0;
+
+    auto sum         = 0u;
+    const auto bytes = reinterpret_cast<const uint8_t*>(&frame);
+    for (auto i = 0u; i < sizeof(Frame); ++i) {
+        sum += bytes[i];
+    }
+    frame.checksum = static_cast<uint8_t>(-sum);
+    pending_       = true;
+}
+
+void flush()
+{
+    if (!pending_) {
+        return;
+    }
+    if (!Serial) {
+        pending_ = false;  // nobody listening, don't let frames pile up
+        return;
+    }
+    // the text log shares the port: a frame goes out in one piece or not at all, so a log line
+    // can only land between frames. a frame still waiting at the next commit counts as dropped.
+    if (Serial.availableForWrite() < static_cast<int>(sizeof(Frame))) {
+        return;
+    }
+    sending_ ^= 1;
+    pending_ = false;
+    Serial.write(reinterpret_cast<const uint8_t*>(&frames_[sending_]), sizeof(Frame));
+}
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::telemetry
@@ -0,0 +1,58 @@
+/**
+ * @file	telemetry.h
+ * @brief	Binary telemetry stream over USB CDC for Tiny KinoKey 25
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#pragma once
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <cstdint>
+
+namespace kinoshita_lab::kinoshi_tiny_key_25::telemetry
+{
+enum
+{
+    kMagic0  = 0xa5,
+    kMagic1  = 0x5a,
+    kVersion = 2,
+};
+
+// fixed layout, little endian. decoded by tools/telemetry_decode.py, keep both in sync.
+// 36 bytes: 3.6 kB/s at 100 Hz, 36 kB/s at 1 kHz.
+struct __attribute__((packed)) Frame
+{
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t length;
+    uint16_t sequence;
+    uint16_t dropped_frames;         // telemetry frames replaced before they were sent
+    uint32_t timestamp_us;
+    uint32_t switches;               // bit n: switch id n is on
+    int8_t octave;
+    int8_t transpose;
+    uint8_t midi_channel;
+    uint8_t scan_mode;               // scan_governor::Mode
+    int16_t pitch_bend;
+    uint8_t usb_midi_queue;          // messages waiting for the USB MIDI sink
+    uint8_t din_midi_queue;          // messages waiting for the DIN MIDI sink
+    uint16_t usb_midi_dropped;       // messages the USB sink dropped (link down, stalled or pool overflow)
+    uint16_t corrupted_scan_frames;  // shift register frames failing the sentinel check
+    uint16_t task_overruns;          // sum over all scheduler tasks
+    uint16_t loop_last_us;
+    uint16_t loop_max_us;            // since the previous frame
+    uint8_t din_midi_dropped;        // messages the DIN sink dropped (pool overflow)
+    uint8_t checksum;                // all bytes of the frame sum to 0
+};
+static_assert(sizeof(Frame) == 36, "telemetry frame layout changed");
+
+// fill the returned frame in place, then commit
+Frame& beginSnapshot();
+void commitSnapshot();
+
+// write the committed frame to USB CDC in one piece, only when all of it fits without blocking
+void flush();
+}  // namespace kinoshita_lab::kinoshi_tiny_key_25::telemetry
+
+#endif  // TELEMETRY_H
@@ -0,0 +1,194 @@
+/**
+ * @file	test_chain.cpp
+ * @brief	Host simulation of a secondary unit's frames merged on the primary
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <unity.h>
+#include <vector>
+#include "chain_link.hpp"
+
+using namespace kinoshita_lab::kinoshi_tiny_key_25;
+using chain_frame::Frame;
+
+namespace
+{
+enum
+{
+    kUnit     = 1,
+    kNumUnits = 4,
+};
+
+struct Event
+{
+    uint8_t unit;
+    uint32_t switch_index;
+    int off_on;
+};
+std::vector<Event> events_;
+
+chain_link::DeltaEncoder encoder_;
+chain_link::Merger<kNumUnits> merger_;
+chain_frame::Parser parser_;
+uint32_t now_ms_       = 0;
+uint32_t frames_sent_  = 0;
+uint32_t drop_frame_   = UINT32_MAX;  // frames_sent_ index lost on the wire
+bool link_up_          = true;
+
+// one scan on the secondary, its frames go over the wire into the primary
+void scan(const uint32_t elapsed_ms)
+{
+    now_ms_ += elapsed_ms;
+    encoder_.update(now_ms_ * 1000, now_ms_, [](const Frame& frame) {
+        if (!link_up_ || frames_sent_++ == drop_frame_) {
+            return;
+        }
+        uint8_t bytes[chain_frame::kMaxFrameSize];
+        const auto size = chain_frame::encode(frame, bytes);
+        for (auto i = 0u; i < size; ++i) {
+            parser_.feed(bytes[i], [](Frame received) {
+                received.hops++;
+                merger_.merge(received, received.age_us, now_ms_);
+            });
+        }
+    });
+    merger_.checkTimeouts(now_ms_);
+}
+
+void change(const uint32_t switch_index, const int off_on)
+{
+    encoder_.switchStateChanged(switch_index, off_on, now_ms_ * 1000);
+}
+
+void assertEvent(const size_t index, const uint32_t switch_index, const int off_on)
+{
+    TEST_ASSERT_TRUE(index < events_.size());
+    TEST_ASSERT_EQUAL(kUnit, events_[index].unit);
+    TEST_ASSERT_EQUAL(switch_index, events_[index].switch_index);
+    TEST_ASSERT_EQUAL(off_on, events_[index].off_on);
+}
+}
+
+void setUp()
+{
+    events_.clear();
+    encoder_     = chain_link::DeltaEncoder(kUnit, 0);
+    merger_      = decltype(merger_)([](uint8_t unit, uint32_t switch_index, int off_on) {
+        events_.push_back({unit, switch_index, off_on});
+    });
+    parser_      = chain_frame::Parser();
+    now_ms_      = 1000;
+    frames_sent_ = 0;
+    drop_frame_  = UINT32_MAX;
+    link_up_     = true;
+    scan(0);  // first state frame brings the unit online
+}
+
+void tearDown()
+{
+}
+
+void test_unit_comes_online()
+{
+    TEST_ASSERT_TRUE(merger_.statistics(kUnit).online);
+    TEST_ASSERT_FALSE(merger_.statistics(kUnit + 1).online);
+    TEST_ASSERT_EQUAL(0, events_.size());
+}
+
+void test_changes_merge_in_order()
+{
+    change(3, 1);
+    change(5, 1);
+    scan(1);
+    change(3, 0);
+    change(9, 1);
+    scan(1);
+    change(5, 0);
+    scan(1);
+    TEST_ASSERT_EQUAL(5, events_.size());
+    assertEvent(0, 3, 1);
+    assertEvent(1, 5, 1);
+    assertEvent(2, 3, 0);
+    assertEvent(3, 9, 1);
+    assertEvent(4, 5, 0);
+    TEST_ASSERT_EQUAL_UINT32(1u << 9, merger_.statistics(kUnit).state);
+    TEST_ASSERT_EQUAL(0, merger_.statistics(kUnit).lost_frames);
+    TEST_ASSERT_EQUAL(3, merger_.statistics(kUnit).delta_frames);
+}
+
+void test_periodic_state_frame_changes_nothing()
+{
+    change(7, 1);
+    scan(1);
+    scan(config::kChainStateIntervalMs);
+    TEST_ASSERT_EQUAL(1, events_.size());
+    TEST_ASSERT_EQUAL(0, merger_.statistics(kUnit).lost_frames);
+}
+
+void test_sequence_gap_is_counted_and_repaired()
+{
+    change(2, 1);
+    scan(1);
+    drop_frame_ = frames_sent_;  // the release is lost
+    change(2, 0);
+    scan(1);
+    change(4, 1);
+    scan(1);
+    TEST_ASSERT_EQUAL(1, merger_.statistics(kUnit).lost_frames);
+    TEST_ASSERT_EQUAL(2, events_.size());
+    assertEvent(1, 4, 1);
+    TEST_ASSERT_TRUE(merger_.statistics(kUnit).state & (1u << 2));  // still held on the primary
+
+    scan(config::kChainStateIntervalMs);  // the state frame releases it
+    TEST_ASSERT_EQUAL(3, events_.size());
+    assertEvent(2, 2, 0);
+    TEST_ASSERT_EQUAL_UINT32(1u << 4, merger_.statistics(kUnit).state);
+}
+
+void test_too_many_changes_fall_back_to_the_state_frame()
+{
+    for (auto i = 0; i < chain_frame::kMaxPayload + 4; ++i) {
+        change(i % 32, (i / 32 + 1) & 1);
+    }
+    scan(1);  // the delta frame is full, the state frame follows at once
+    TEST_ASSERT_EQUAL(chain_frame::kMaxPayload + 4, events_.size());
+    TEST_ASSERT_EQUAL_UINT32(encoder_.localState(), merger_.statistics(kUnit).state);
+    TEST_ASSERT_EQUAL(0, merger_.statistics(kUnit).lost_frames);
+}
+
+void test_timeout_releases_held_switches()
+{
+    change(2, 1);
+    change(4, 1);
+    scan(1);
+    link_up_ = false;  // unplugged
+    scan(config::kChainTimeoutMs - 1);
+    TEST_ASSERT_TRUE(merger_.statistics(kUnit).online);
+    TEST_ASSERT_EQUAL(2, events_.size());
+
+    scan(1);
+    TEST_ASSERT_FALSE(merger_.statistics(kUnit).online);
+    TEST_ASSERT_EQUAL(4, events_.size());
+    assertEvent(2, 2, 0);
+    assertEvent(3, 4, 0);
+    TEST_ASSERT_EQUAL_UINT32(0, merger_.statistics(kUnit).state);
+
+    link_up_ = true;  // plugged back in, the next state frame restores what is held
+    scan(config::kChainStateIntervalMs);
+    TEST_ASSERT_TRUE(merger_.statistics(kUnit).online);
+    TEST_ASSERT_EQUAL(6, events_.size());
+    assertEvent(4, 2, 1);
+    assertEvent(5, 4, 1);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_unit_comes_online);
+    RUN_TEST(test_changes_merge_in_order);
+    RUN_TEST(test_periodic_state_frame_changes_nothing);
+    RUN_TEST(test_sequence_gap_is_counted_and_repaired);
+    RUN_TEST(test_too_many_changes_fall_back_to_the_state_frame);
+    RUN_TEST(test_timeout_releases_held_switches);
+    return UNITY_END();
+}
@@ -0,0 +1,109 @@
+/**
+ * @file	test_chain_frame.cpp
+ * @brief	Host tests for the chain frame encoder and parser
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <unity.h>
+#include <vector>
+#include "chain_frame.hpp"
+
+using namespace kinoshita_lab::kinoshi_tiny_key_25;
+using chain_frame::Frame;
+
+namespace
+{
+std::vector<uint8_t> stream_;
+std::vector<Frame> frames_;
+chain_frame::Parser parser_;
+
+Frame deltaFrame(const uint8_t sequence, const uint32_t switch_index, const int off_on)
+{
+    Frame frame;
+    frame.unit                    = 1;
+    frame.sequence                = sequence;
+    frame.age_us                  = 100;
+    frame.payload[frame.length++] = Frame::change(switch_index, off_on);
+    return frame;
+}
+
+void append(const Frame& frame)
+{
+    uint8_t bytes[chain_frame::kMaxFrameSize];
+    const auto size = chain_frame::encode(frame, bytes);
+    stream_.insert(stream_.end(), bytes, bytes + size);
+}
+
+void feedStream()
+{
+    for (const auto byte : stream_) {
+        parser_.feed(byte, [](const Frame& frame) { frames_.push_back(frame); });
+    }
+}
+}
+
+void setUp()
+{
+    stream_.clear();
+    frames_.clear();
+    parser_ = chain_frame::Parser();
+}
+
+void tearDown()
+{
+}
+
+void test_frame_round_trip()
+{
+    Frame state;
+    state.unit     = 3;
+    state.hops     = 2;
+    state.sequence = 200;
+    state.setState(0x01234567);
+    append(state);
+    feedStream();
+    TEST_ASSERT_EQUAL(1, frames_.size());
+    TEST_ASSERT_EQUAL(3, frames_[0].unit);
+    TEST_ASSERT_EQUAL(2, frames_[0].hops);
+    TEST_ASSERT_EQUAL(chain_frame::kFrameState, frames_[0].type);
+    TEST_ASSERT_EQUAL(200, frames_[0].sequence);
+    TEST_ASSERT_EQUAL_UINT32(0x01234567, frames_[0].state());
+}
+
+void test_corrupted_frame_is_dropped()
+{
+    append(deltaFrame(0, 5, 1));
+    stream_[chain_frame::kHeaderSize] ^= 0x01;  // payload bit error
+    append(deltaFrame(1, 5, 0));
+    feedStream();
+    TEST_ASSERT_EQUAL(1, frames_.size());
+    TEST_ASSERT_EQUAL(1, frames_[0].sequence);
+    TEST_ASSERT_EQUAL(1, parser_.corruptedFrames());
+}
+
+// a stray magic whose header claims a full payload swallows the frames behind it, the replay must deliver all of them
+void test_stray_header_does_not_swallow_frames()
+{
+    const uint8_t stray[chain_frame::kHeaderSize] = {chain_frame::kMagic, 0x10, chain_frame::kFrameDelta, 0, 0, 0,
+                                                     chain_frame::kMaxPayload};
+    stream_.insert(stream_.end(), stray, stray + sizeof(stray));
+    for (auto i = 0; i < 4; ++i) {
+        append(deltaFrame(static_cast<uint8_t>(10 + i), i, 1));
+    }
+    feedStream();
+    TEST_ASSERT_EQUAL(1, parser_.corruptedFrames());
+    TEST_ASSERT_EQUAL(4, frames_.size());
+    for (auto i = 0; i < 4; ++i) {
+        TEST_ASSERT_EQUAL(10 + i, frames_[i].sequence);
+        TEST_ASSERT_EQUAL_UINT8(Frame::change(i, 1), frames_[i].payload[0]);
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_round_trip);
+    RUN_TEST(test_corrupted_frame_is_dropped);
+    RUN_TEST(test_stray_header_does_not_swallow_frames);
+    return UNITY_END();
+}
@@ -0,0 +1,121 @@
+/**
+ * @file	test_controllers.cpp
+ * @brief	Host tests for sustain, modulation and pitch bend held across channel and CC changes
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <unity.h>
+#include <vector>
+#include "controllers.hpp"
+
+using namespace kinoshita_lab::kinoshi_tiny_key_25;
+
+namespace
+{
+struct Sent
+{
+    bool pitch_bend;
+    int control_number;
+    int value;
+    int channel;
+};
+std::vector<Sent> sent_;
+controllers::Controllers controllers_;
+
+void assertControlChange(const size_t index, const int control_number, const int value, const int channel)
+{
+    TEST_ASSERT_TRUE(index < sent_.size());
+    TEST_ASSERT_FALSE(sent_[index].pitch_bend);
+    TEST_ASSERT_EQUAL_INT(control_number, sent_[index].control_number);
+    TEST_ASSERT_EQUAL_INT(value, sent_[index].value);
+    TEST_ASSERT_EQUAL_INT(channel, sent_[index].channel);
+}
+
+void assertPitchBend(const size_t index, const int channel)
+{
+    TEST_ASSERT_TRUE(index < sent_.size());
+    TEST_ASSERT_TRUE(sent_[index].pitch_bend);
+    TEST_ASSERT_EQUAL_INT(channel, sent_[index].channel);
+}
+}
+
+void setUp()
+{
+    sent_.clear();
+    controllers_ = controllers::Controllers(
+        [](uint8_t control_number, uint8_t value, uint8_t channel) {
+            sent_.push_back({false, control_number, value, channel});
+        },
+        [](int16_t value, uint8_t channel) {
+            sent_.push_back({true, 0, value, channel});
+        },
+        100.f);
+}
+
+void tearDown()
+{
+}
+
+void test_sustain_releases_on_the_channel_it_was_pressed_on()
+{
+    controllers_.sustain(1, 1);
+    controllers_.sustain(0, 3);  // channel 3 selected while held
+    TEST_ASSERT_EQUAL(2, sent_.size());
+    assertControlChange(0, controllers::kSustainControl, 127, 1);
+    assertControlChange(1, controllers::kSustainControl, 0, 1);
+
+    controllers_.sustain(1, 3);  // the next press plays on the new channel
+    assertControlChange(2, controllers::kSustainControl, 127, 3);
+}
+
+void test_modulation_releases_the_control_it_was_pressed_with()
+{
+    controllers_.modulation(1, 1, 1);
+    controllers_.modulation(0, 11, 2);  // CC 11 and channel 2 selected while held
+    TEST_ASSERT_EQUAL(2, sent_.size());
+    assertControlChange(0, 1, 127, 1);
+    assertControlChange(1, 1, 0, 1);
+}
+
+void test_pitch_bend_stays_on_the_channel_it_was_pressed_on()
+{
+    controllers_.pitchBend(1, 1);
+    controllers_.update(10);
+    TEST_ASSERT_EQUAL(1, sent_.size());
+    assertPitchBend(0, 1);
+    TEST_ASSERT_EQUAL_INT(1000, sent_[0].value);
+
+    // channel 3 selected while held: the rest of the sweep and the reset stay on channel 1
+    controllers_.update(10);
+    controllers_.pitchBend(0, 3);
+    controllers_.update(1);
+    TEST_ASSERT_EQUAL(3, sent_.size());
+    assertPitchBend(1, 1);
+    TEST_ASSERT_EQUAL_INT(2000, sent_[1].value);
+    assertPitchBend(2, 1);
+    TEST_ASSERT_EQUAL_INT(0, sent_[2].value);
+    TEST_ASSERT_EQUAL_INT(0, controllers_.pitchBendValue());
+}
+
+void test_pitch_bend_on_another_channel_centers_the_old_one()
+{
+    controllers_.pitchBend(1, 1);
+    controllers_.update(10);
+    controllers_.pitchBend(-1, 2);  // the other bend switch, pressed after a channel change
+    controllers_.update(10);
+    TEST_ASSERT_EQUAL(3, sent_.size());
+    assertPitchBend(1, 1);
+    TEST_ASSERT_EQUAL_INT(0, sent_[1].value);
+    assertPitchBend(2, 2);
+    TEST_ASSERT_EQUAL_INT(-1000, sent_[2].value);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_sustain_releases_on_the_channel_it_was_pressed_on);
+    RUN_TEST(test_modulation_releases_the_control_it_was_pressed_with);
+    RUN_TEST(test_pitch_bend_stays_on_the_channel_it_was_pressed_on);
+    RUN_TEST(test_pitch_bend_on_another_channel_centers_the_old_one);
+    return UNITY_END();
+}
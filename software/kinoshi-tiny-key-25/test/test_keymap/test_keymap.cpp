@@ -0,0 +1,207 @@
+/**
+ * @file	test_keymap.cpp
+ * @brief	Host tests for keymap layers and tap/hold handling
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <unity.h>
+#include <vector>
+#include "keymap.hpp"
+
+using namespace kinoshita_lab::kinoshi_tiny_key_25;
+using keymap::Action;
+using keymap::Keymap;
+using switches::SwitchIds;
+
+namespace
+{
+struct Event
+{
+    keymap::ActionType type;
+    int value;
+    int off_on;
+};
+std::vector<Event> events_;
+Keymap keymap_;
+
+void press(const uint32_t switch_index, const uint32_t now_ms)
+{
+    keymap_.switchStateChanged(switch_index, 1, now_ms);
+}
+
+void release(const uint32_t switch_index, const uint32_t now_ms)
+{
+    keymap_.switchStateChanged(switch_index, 0, now_ms);
+}
+
+void holdPastTerm(const uint32_t switch_index, const uint32_t now_ms)
+{
+    press(switch_index, now_ms);
+    keymap_.update(now_ms + config::kTapHoldTermMs);
+}
+
+void assertEvent(const size_t index, const keymap::ActionType type, const int value, const int off_on)
+{
+    TEST_ASSERT_TRUE(index < events_.size());
+    TEST_ASSERT_EQUAL_INT(type, events_[index].type);
+    TEST_ASSERT_EQUAL_INT(value, events_[index].value);
+    TEST_ASSERT_EQUAL_INT(off_on, events_[index].off_on);
+}
+}
+
+void setUp()
+{
+    events_.clear();
+    keymap_ = Keymap([](const Action& action, const int off_on) {
+        events_.push_back({action.type, action.value, off_on});
+    });
+}
+
+void tearDown()
+{
+}
+
+void test_key_plays_note()
+{
+    press(SwitchIds::kSwitchIdC1, 0);
+    release(SwitchIds::kSwitchIdC1, 10);
+    TEST_ASSERT_EQUAL(2, events_.size());
+    assertEvent(0, keymap::kActionNote, 0, 1);
+    assertEvent(1, keymap::kActionNote, 0, 0);
+}
+
+void test_tap_changes_octave_on_press()
+{
+    press(SwitchIds::kSwitchIdOctPlus, 0);
+    TEST_ASSERT_EQUAL(1, events_.size());  // no latency, taken back if it becomes a hold
+    assertEvent(0, keymap::kActionOctave, 1, 1);
+    release(SwitchIds::kSwitchIdOctPlus, config::kTapHoldTermMs - 1);
+    TEST_ASSERT_EQUAL(2, events_.size());
+    assertEvent(1, keymap::kActionOctave, 1, 0);
+    TEST_ASSERT_EQUAL(keymap::kLayerBase, keymap_.activeLayer());
+}
+
+void test_hold_selects_layer()
+{
+    holdPastTerm(SwitchIds::kSwitchIdOctMinus, 0);
+    TEST_ASSERT_EQUAL(keymap::kLayerChannel, keymap_.activeLayer());
+    TEST_ASSERT_EQUAL(2, events_.size());
+    assertEvent(0, keymap::kActionOctave, -1, 1);
+    assertEvent(1, keymap::kActionOctave, -1, keymap::kActionCancelled);
+    press(SwitchIds::kSwitchIdC1 + 2, 300);
+    assertEvent(2, keymap::kActionChannel, 3, 1);
+
+    release(SwitchIds::kSwitchIdOctMinus, 400);
+    TEST_ASSERT_EQUAL(keymap::kLayerBase, keymap_.activeLayer());
+    TEST_ASSERT_EQUAL(3, events_.size());  // no octave change on release after hold
+}
+
+// playing: the next note starts before the octave switch is fully released
+void test_rolling_from_a_tap_into_a_note_plays_the_note()
+{
+    press(SwitchIds::kSwitchIdOctPlus, 0);
+    press(SwitchIds::kSwitchIdC1, 50);
+    TEST_ASSERT_EQUAL(1, events_.size());  // the note waits for the decision
+    release(SwitchIds::kSwitchIdOctPlus, 80);
+    TEST_ASSERT_EQUAL(keymap::kLayerBase, keymap_.activeLayer());
+    TEST_ASSERT_EQUAL(3, events_.size());
+    assertEvent(0, keymap::kActionOctave, 1, 1);
+    assertEvent(1, keymap::kActionOctave, 1, 0);
+    assertEvent(2, keymap::kActionNote, 0, 1);  // after the octave change
+    release(SwitchIds::kSwitchIdC1, 120);
+    assertEvent(3, keymap::kActionNote, 0, 0);
+}
+
+void test_key_pressed_and_released_while_held_means_hold()
+{
+    press(SwitchIds::kSwitchIdOctPlus, 0);
+    press(SwitchIds::kSwitchIdC1, 50);
+    release(SwitchIds::kSwitchIdC1, 80);
+    TEST_ASSERT_EQUAL(keymap::kLayerTranspose, keymap_.activeLayer());
+    TEST_ASSERT_EQUAL(4, events_.size());
+    assertEvent(1, keymap::kActionOctave, 1, keymap::kActionCancelled);
+    assertEvent(2, keymap::kActionTranspose, -config::kTransposeCenterKey, 1);
+    assertEvent(3, keymap::kActionTranspose, -config::kTransposeCenterKey, 0);
+    release(SwitchIds::kSwitchIdOctPlus, 100);
+    TEST_ASSERT_EQUAL(4, events_.size());  // no octave tap
+}
+
+void test_key_waiting_for_the_hold_term_plays_on_the_layer()
+{
+    press(SwitchIds::kSwitchIdOctPlus, 0);
+    press(SwitchIds::kSwitchIdC1, 50);
+    keymap_.update(config::kTapHoldTermMs);
+    TEST_ASSERT_EQUAL(keymap::kLayerTranspose, keymap_.activeLayer());
+    TEST_ASSERT_EQUAL(3, events_.size());
+    assertEvent(1, keymap::kActionOctave, 1, keymap::kActionCancelled);
+    assertEvent(2, keymap::kActionTranspose, -config::kTransposeCenterKey, 1);
+}
+
+void test_note_held_across_layer_change_is_released()
+{
+    press(SwitchIds::kSwitchIdC1 + 4, 0);
+    holdPastTerm(SwitchIds::kSwitchIdOctMinus, 10);
+    release(SwitchIds::kSwitchIdC1 + 4, 300);  // released on the channel layer
+    release(SwitchIds::kSwitchIdOctMinus, 400);
+    TEST_ASSERT_EQUAL(4, events_.size());
+    assertEvent(0, keymap::kActionNote, 4, 1);
+    assertEvent(3, keymap::kActionNote, 4, 0);  // the note, not a channel change
+}
+
+void test_function_held_across_layer_change_is_released()
+{
+    holdPastTerm(SwitchIds::kSwitchIdOctPlus, 0);
+    press(SwitchIds::kSwitchIdC1, 300);  // transpose key pressed on the layer
+    release(SwitchIds::kSwitchIdOctPlus, 400);
+    release(SwitchIds::kSwitchIdC1, 500);  // back on the base layer
+    TEST_ASSERT_EQUAL(4, events_.size());
+    assertEvent(3, keymap::kActionTranspose, -config::kTransposeCenterKey, 0);
+}
+
+void test_both_octave_switches_select_control()
+{
+    holdPastTerm(SwitchIds::kSwitchIdOctMinus, 0);
+    press(SwitchIds::kSwitchIdOctPlus, 300);
+    TEST_ASSERT_EQUAL(keymap::kLayerControl, keymap_.activeLayer());
+    press(SwitchIds::kSwitchIdC1, 310);
+    assertEvent(2, keymap::kActionControlNumber, config::kSelectableControlNumbers[0], 1);
+    release(SwitchIds::kSwitchIdC1, 320);
+}
+
+void test_releasing_one_octave_switch_leaves_the_other_layer()
+{
+    holdPastTerm(SwitchIds::kSwitchIdOctMinus, 0);
+    press(SwitchIds::kSwitchIdOctPlus, 300);
+    release(SwitchIds::kSwitchIdOctMinus, 400);
+    TEST_ASSERT_EQUAL(keymap::kLayerTranspose, keymap_.activeLayer());
+    press(SwitchIds::kSwitchIdC1, 500);
+    assertEvent(2, keymap::kActionTranspose, -config::kTransposeCenterKey, 1);
+    release(SwitchIds::kSwitchIdC1, 510);
+    release(SwitchIds::kSwitchIdOctPlus, 600);
+    TEST_ASSERT_EQUAL(keymap::kLayerBase, keymap_.activeLayer());
+
+    // the other way round
+    holdPastTerm(SwitchIds::kSwitchIdOctPlus, 1000);
+    press(SwitchIds::kSwitchIdOctMinus, 1300);
+    TEST_ASSERT_EQUAL(keymap::kLayerControl, keymap_.activeLayer());
+    release(SwitchIds::kSwitchIdOctPlus, 1400);
+    TEST_ASSERT_EQUAL(keymap::kLayerChannel, keymap_.activeLayer());
+    release(SwitchIds::kSwitchIdOctMinus, 1500);
+    TEST_ASSERT_EQUAL(keymap::kLayerBase, keymap_.activeLayer());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_key_plays_note);
+    RUN_TEST(test_tap_changes_octave_on_press);
+    RUN_TEST(test_hold_selects_layer);
+    RUN_TEST(test_rolling_from_a_tap_into_a_note_plays_the_note);
+    RUN_TEST(test_key_pressed_and_released_while_held_means_hold);
+    RUN_TEST(test_key_waiting_for_the_hold_term_plays_on_the_layer);
+    RUN_TEST(test_note_held_across_layer_change_is_released);
+    RUN_TEST(test_function_held_across_layer_change_is_released);
+    RUN_TEST(test_both_octave_switches_select_control);
+    RUN_TEST(test_releasing_one_octave_switch_leaves_the_other_layer);
+    return UNITY_END();
+}
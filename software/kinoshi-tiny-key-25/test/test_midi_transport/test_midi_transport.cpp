@@ -0,0 +1,270 @@
+/**
+ * @file	test_midi_transport.cpp
+ * @brief	Host tests for the MIDI transport fan out and coalescing
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ */
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "midi_transport.hpp"
+
+using namespace kinoshita_lab::kinoshi_tiny_key_25;
+using midi_transport::Message;
+
+namespace
+{
+enum
+{
+    kSinkUsb,
+    kSinkDin,
+    kNumSinks,
+};
+
+// takes a message whenever ready_at_us has passed, busy_us per message. 0: always ready. never takes one unless accepting
+class FakeSink : public midi_transport::Sink
+{
+public:
+    explicit FakeSink(const uint32_t busy_us = 0) : busy_us_(busy_us) {}
+
+    bool write(const Message& message) override
+    {
+        if (!accepting || now_us_ < ready_at_us_) {
+            return false;
+        }
+        ready_at_us_ = now_us_ + busy_us_;
+        received.push_back(message);
+        received_at_us.push_back(now_us_);
+        return true;
+    }
+
+    int count(const midi_transport::MessageType type) const
+    {
+        auto n = 0;
+        for (const auto& message : received) {
+            n += message.type() == type;
+        }
+        return n;
+    }
+
+    static uint32_t now_us_;
+    bool accepting = true;
+    std::vector<Message> received;
+    std::vector<uint32_t> received_at_us;
+
+protected:
+    uint32_t busy_us_;
+    uint32_t ready_at_us_ = 0;
+};
+uint32_t FakeSink::now_us_ = 0;
+
+FakeSink usb_;
+FakeSink din_(960);  // 3 bytes at 31250 baud
+midi_transport::Transport<64, kNumSinks> transport_;
+
+void assertMessage(const Message& expected, const Message& actual)
+{
+    TEST_ASSERT_EQUAL(expected.length, actual.length);
+    for (auto i = 0u; i < expected.length; ++i) {
+        TEST_ASSERT_EQUAL_UINT8(expected.bytes[i], actual.bytes[i]);
+    }
+}
+}
+
+void setUp()
+{
+    FakeSink::now_us_ = 0;
+    usb_              = FakeSink();
+    din_              = FakeSink(960);
+    transport_        = decltype(transport_)();
+    transport_.addSink(&usb_);
+    transport_.addSink(&din_);
+}
+
+void tearDown()
+{
+}
+
+void test_every_sink_gets_every_message()
+{
+    transport_.publish(midi_transport::noteOn(60, 100, 1));
+    transport_.publish(midi_transport::noteOff(60, 0, 1));
+    transport_.flush(FakeSink::now_us_);
+    FakeSink::now_us_ = 1000;
+    transport_.flush(FakeSink::now_us_);
+    TEST_ASSERT_EQUAL(2, usb_.received.size());
+    TEST_ASSERT_EQUAL(2, din_.received.size());
+    assertMessage(midi_transport::noteOff(60, 0, 1), din_.received[1]);
+}
+
+void test_pitch_bend_replaces_the_queued_one()
+{
+    transport_.publish(midi_transport::pitchBend(100, 1));
+    transport_.publish(midi_transport::pitchBend(300, 1));
+    transport_.publish(midi_transport::pitchBend(200, 2));  // another channel
+    TEST_ASSERT_EQUAL(2, transport_.queueDepth(kSinkDin));
+    transport_.flush(FakeSink::now_us_);
+    TEST_ASSERT_EQUAL(2, usb_.received.size());
+    assertMessage(midi_transport::pitchBend(300, 1), usb_.received[0]);
+    assertMessage(midi_transport::pitchBend(200, 2), usb_.received[1]);
+}
+
+// a note is played with the values published before it, a later value must not overtake it
+void test_values_do_not_overtake_notes()
+{
+    const Message published[] = {
+        midi_transport::controlChange(1, 127, 1),
+        midi_transport::noteOn(60, 100, 1),
+        midi_transport::controlChange(1, 0, 1),
+        midi_transport::pitchBend(8000, 1),
+        midi_transport::noteOff(60, 0, 1),
+        midi_transport::pitchBend(0, 1),
+    };
+    for (const auto& message : published) {
+        transport_.publish(message);
+    }
+    for (FakeSink::now_us_ = 0; FakeSink::now_us_ < 10000; FakeSink::now_us_ += 100) {
+        transport_.flush(FakeSink::now_us_);
+    }
+    TEST_ASSERT_EQUAL(6, din_.received.size());
+    for (auto i = 0u; i < 6; ++i) {
+        assertMessage(published[i], din_.received[i]);
+    }
+}
+
+void test_values_still_coalesce_between_notes()
+{
+    transport_.publish(midi_transport::noteOn(60, 100, 1));
+    transport_.publish(midi_transport::pitchBend(100, 1));
+    transport_.publish(midi_transport::noteOn(62, 100, 2));  // another channel does not hold it back
+    transport_.publish(midi_transport::pitchBend(200, 1));
+    TEST_ASSERT_EQUAL(3, transport_.queueDepth(kSinkDin));
+    transport_.flush(FakeSink::now_us_);
+    assertMessage(midi_transport::pitchBend(200, 1), usb_.received[1]);
+}
+
+void test_control_change_coalesces_per_controller_but_sustain_does_not()
+{
+    transport_.publish(midi_transport::controlChange(1, 10, 1));
+    transport_.publish(midi_transport::controlChange(7, 20, 1));
+    transport_.publish(midi_transport::controlChange(1, 30, 1));
+    transport_.publish(midi_transport::controlChange(64, 127, 1));
+    transport_.publish(midi_transport::controlChange(64, 0, 1));
+    transport_.publish(midi_transport::controlChange(64, 127, 1));
+    transport_.flush(FakeSink::now_us_);
+    TEST_ASSERT_EQUAL(5, usb_.received.size());
+    assertMessage(midi_transport::controlChange(1, 30, 1), usb_.received[0]);
+    assertMessage(midi_transport::controlChange(64, 0, 1), usb_.received[3]);
+}
+
+void test_sink_that_already_read_gets_a_new_slot()
+{
+    transport_.publish(midi_transport::pitchBend(100, 1));
+    transport_.flush(FakeSink::now_us_);  // usb reads it, din takes it too and is busy for 960 us
+    transport_.publish(midi_transport::pitchBend(200, 1));
+    transport_.flush(FakeSink::now_us_);  // usb only, din is busy
+    transport_.publish(midi_transport::pitchBend(300, 1));
+    transport_.flush(FakeSink::now_us_);
+    FakeSink::now_us_ = 1000;
+    transport_.flush(FakeSink::now_us_);
+    TEST_ASSERT_EQUAL(3, usb_.received.size());
+    TEST_ASSERT_EQUAL(2, din_.received.size());
+    assertMessage(midi_transport::pitchBend(300, 1), din_.received[1]);
+}
+
+void test_queued_for_a_sink_the_new_message_skips_is_kept()
+{
+    transport_.publish(midi_transport::pitchBend(100, 1), 1u << kSinkDin);
+    transport_.publish(midi_transport::pitchBend(200, 1), 1u << kSinkUsb);
+    transport_.flush(FakeSink::now_us_);
+    TEST_ASSERT_EQUAL(1, usb_.received.size());
+    TEST_ASSERT_EQUAL(1, din_.received.size());
+    assertMessage(midi_transport::pitchBend(100, 1), din_.received[0]);
+}
+
+// 250 ms pitch bend sweep published every 500 us while 20 held notes are released, DIN drains one message per ms
+void test_pitch_bend_sweep_keeps_every_note_off()
+{
+    for (auto note = 0; note < 20; ++note) {
+        transport_.publish(midi_transport::noteOn(48 + note, 100, 1));
+    }
+    auto max_depth = 0u;
+    auto bend      = 0;
+    for (FakeSink::now_us_ = 0; FakeSink::now_us_ < 400000; FakeSink::now_us_ += 100) {
+        const auto now_us = FakeSink::now_us_;
+        if (now_us < 250000 && now_us % 500 == 0) {
+            bend = static_cast<int>(now_us * 8191 / 250000);
+            transport_.publish(midi_transport::pitchBend(bend, 1));
+        }
+        if (now_us < 250000 && now_us % 12500 == 0) {
+            transport_.publish(midi_transport::noteOff(48 + now_us / 12500, 0, 1));
+        }
+        TEST_ASSERT_FALSE(transport_.full());
+        max_depth = std::max(max_depth, transport_.queueDepth(kSinkDin));
+        transport_.flush(FakeSink::now_us_);
+    }
+    TEST_ASSERT_EQUAL(0, transport_.dropped(kSinkUsb));
+    TEST_ASSERT_EQUAL(0, transport_.dropped(kSinkDin));
+    TEST_ASSERT_EQUAL(20, din_.count(midi_transport::kTypeNoteOff));
+    TEST_ASSERT_EQUAL(20, usb_.count(midi_transport::kTypeNoteOff));
+    TEST_ASSERT_EQUAL(500, usb_.count(midi_transport::kTypePitchBend));
+    assertMessage(midi_transport::pitchBend(bend, 1), din_.received.back());
+    TEST_ASSERT_LESS_OR_EQUAL(22, max_depth);  // the note ons, then about one pending bend and note off
+}
+
+// USB mounted but the host never reads: DIN must not wait for it, and USB picks up again once the host reads
+void test_stalled_sink_does_not_delay_the_others()
+{
+    usb_.accepting = false;
+    std::vector<uint32_t> published_at_us;
+    for (FakeSink::now_us_ = 0; FakeSink::now_us_ < 1000000; FakeSink::now_us_ += 100) {
+        const auto now_us = FakeSink::now_us_;
+        if (now_us % 500 == 0) {
+            transport_.publish(midi_transport::pitchBend(static_cast<int16_t>(now_us / 500), 1));
+        }
+        if (now_us % 5000 == 0) {
+            const auto note = static_cast<uint8_t>(48 + (now_us / 10000) % 24);
+            transport_.publish((now_us / 5000) & 1 ? midi_transport::noteOff(note, 0, 1) : midi_transport::noteOn(note, 100, 1));
+            published_at_us.push_back(now_us);
+        }
+        TEST_ASSERT_FALSE(transport_.full());
+        transport_.flush(FakeSink::now_us_);
+    }
+    TEST_ASSERT_TRUE(transport_.stalled(kSinkUsb));
+    TEST_ASSERT_FALSE(transport_.stalled(kSinkDin));
+    TEST_ASSERT_GREATER_THAN(0, transport_.dropped(kSinkUsb));
+    TEST_ASSERT_EQUAL(0, transport_.dropped(kSinkDin));
+
+    // every note reaches DIN, and as quickly at the end as before the stall was detected
+    auto note_index = 0u;
+    auto max_latency_us = 0u;
+    for (auto i = 0u; i < din_.received.size(); ++i) {
+        if (din_.received[i].type() == midi_transport::kTypePitchBend) {
+            continue;
+        }
+        max_latency_us = std::max(max_latency_us, din_.received_at_us[i] - published_at_us[note_index++]);
+    }
+    TEST_ASSERT_EQUAL(published_at_us.size(), note_index);
+    TEST_ASSERT_LESS_OR_EQUAL(2000, max_latency_us);
+
+    usb_.accepting = true;
+    transport_.publish(midi_transport::noteOff(48, 0, 1));
+    transport_.flush(FakeSink::now_us_);
+    TEST_ASSERT_FALSE(transport_.stalled(kSinkUsb));
+    assertMessage(midi_transport::noteOff(48, 0, 1), usb_.received.back());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_every_sink_gets_every_message);
+    RUN_TEST(test_pitch_bend_replaces_the_queued_one);
+    RUN_TEST(test_values_do_not_overtake_notes);
+    RUN_TEST(test_values_still_coalesce_between_notes);
+    RUN_TEST(test_control_change_coalesces_per_controller_but_sustain_does_not);
+    RUN_TEST(test_sink_that_already_read_gets_a_new_slot);
+    RUN_TEST(test_queued_for_a_sink_the_new_message_skips_is_kept);
+    RUN_TEST(test_pitch_bend_sweep_keeps_every_note_off);
+    RUN_TEST(test_stalled_sink_does_not_delay_the_others);
+    return UNITY_END();
+}
@@ -0,0 +1,86 @@
+/**
+ * @file	midi_transport_bench.cpp
+ * @brief	Host benchmark: MIDI transport cost per event against the number of sinks
+ * @author Kazuki Saita <saita@kinoshita-lab.com>
+ * Copyright (c) 2025 Kinoshita Laboratory All rights reserved.
+ *
+ * build and run from the project directory:
+ *     g++ -O2 -std=gnu++17 -Isrc tools/midi_transport_bench.cpp -o midi_transport_bench && ./midi_transport_bench
+ * one event is one publish and one flush, the mix is a note on, a pitch bend and a note off.
+ * host numbers, scale them for the RP2040 before reading them as firmware timings.
+ */
+#include <chrono>
+#include <cstdio>
+#include "midi_transport.hpp"
+
+using namespace kinoshita_lab::kinoshi_tiny_key_25;
+
+namespace
+{
+enum
+{
+    kPoolSize  = 64,
+    kMaxSinks  = 8,
+    kNumEvents = 3000000,
+};
+
+class CountingSink : public midi_transport::Sink
+{
+public:
+    bool write(const midi_transport::Message& message) override
+    {
+        bytes += message.length;
+        return true;
+    }
+
+    uint64_t bytes = 0;
+};
+
+double nanosecondsPerEvent(const size_t num_sinks)
+{
+    CountingSink sinks[kMaxSinks];
+    midi_transport::Transport<kPoolSize, kMaxSinks> transport;
+    for (auto i = 0u; i < num_sinks; ++i) {
+        transport.addSink(&sinks[i]);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < kNumEvents; ++i) {
+        const auto note = static_cast<uint8_t>(i & 0x7f);
+        switch (i % 3) {
+        case 0:
+            transport.publish(midi_transport::noteOn(note, 100, 1));
+            break;
+        case 1:
+            transport.publish(midi_transport::pitchBend(static_cast<int16_t>(i & 0x1fff), 1));
+            break;
+        default:
+            transport.publish(midi_transport::noteOff(note, 0, 1));
+            break;
+        }
+        transport.flush(static_cast<uint32_t>(i));
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // keep the writes observable so they are not optimized away
+    auto bytes = uint64_t{0};
+    for (auto i = 0u; i < num_sinks; ++i) {
+        bytes += sinks[i].bytes;
+    }
+    if (bytes != uint64_t{3} * kNumEvents * num_sinks) {
+        std::printf("sink byte count mismatch: %llu\n", static_cast<unsigned long long>(bytes));
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / kNumEvents;
+}
+}
+
+int main()
+{
+    constexpr size_t kSinkCounts[] = {1, 2, 4, 8};
+    std::printf("sinks  ns/event  ns/event/sink\n");
+    for (const auto num_sinks : kSinkCounts) {
+        const auto ns = nanosecondsPerEvent(num_sinks);
+        std::printf("%5zu  %8.1f  %13.1f\n", num_sinks, ns, ns / num_sinks);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Decode the Kinoshi-Tiny Key 25 binary telemetry stream into CSV.
+
+Enable it with config::kTelemetryEnabled. Frames are 36 bytes, so the stream
+costs 3.6 kB/s at 100 Hz and 36 kB/s at 1 kHz on USB CDC.
+
+Text log lines share the same CDC port. The firmware writes each frame in one
+piece, so log lines only fall between frames, and the decoder skips them by
+resynchronizing on the frame magic and checksum. Frames that could not be
+written in time are counted in dropped_frames.
+
+usage:
+    telemetry_decode.py /dev/ttyACM0 > log.csv       (needs pyserial)
+    telemetry_decode.py capture.bin > log.csv
+"""
+import argparse
+import csv
+import os
+import stat
+import struct
+import sys
+
+# keep in sync with telemetry::Frame in src/telemetry.h
+MAGIC = b"\xa5\x5a"
+VERSION = 2
+FRAME = struct.Struct("<2sBBHHIIbbBBhBBHHHHHBB")
+FIELDS = [
+    "sequence",
+    "dropped_frames",
+    "timestamp_us",
+    "switches",
+    "octave",
+    "transpose",
+    "midi_channel",
+    "scan_mode",
+    "pitch_bend",
+    "usb_midi_queue",
+    "din_midi_queue",
+    "usb_midi_dropped",
+    "corrupted_scan_frames",
+    "task_overruns",
+    "loop_last_us",
+    "loop_max_us",
+    "din_midi_dropped",
+]
+assert FRAME.size == 36
+
+
+def open_source(path):
+    mode = os.stat(path).st_mode
+    if stat.S_ISCHR(mode):
+        import serial  # pyserial
+
+        return serial.Serial(path, timeout=1)
+    return open(path, "rb")
+
+
+def frames(source):
+    buffer = bytearray()
+    while True:
+        chunk = source.read(256)
+        if not chunk:
+            if not hasattr(source, "in_waiting"):
+                return  # end of file
+            continue
+        buffer += chunk
+        while True:
+            start = buffer.find(MAGIC)
+            if start < 0:
+                del buffer[:-1]
+                break
+            del buffer[:start]
+            if len(buffer) < FRAME.size:
+                break
+            raw = bytes(buffer[: FRAME.size])
+            values = FRAME.unpack(raw)
+            if values[1] != VERSION or values[2] != FRAME.size or sum(raw) & 0xFF:
+                del buffer[:1]  # not a frame, or a text line got mixed in
+                continue
+            del buffer[: FRAME.size]
+            yield values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="serial port or captured file")
+    args = parser.parse_args()
+
+    writer = csv.writer(sys.stdout)
+    writer.writerow(FIELDS)
+    with open_source(args.source) as source:
+        try:
+            for values in frames(source):
+                (_, _, _, sequence, dropped, timestamp, switches, *rest, _) = values
+                writer.writerow([sequence, dropped, timestamp, "0x%08x" % switches, *rest])
+                sys.stdout.flush()
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == "__main__":
+    main()